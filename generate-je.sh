@@ -18,6 +18,15 @@ ZFS_JAIL_NAME="main"
 ZFS_BOOTFS_NAME="default"
 ZFS_BEROOT_NAME="JAIL"
 
+# variants of the jail environment built from the one world poudriere
+# installed, "name:packagelist:overlaydir ...". Either of packagelist
+# and overlaydir may be empty. Only for jail environment streams.
+: ${JE_VARIANTS:=}
+
+# package repository the variants install from, by default the one
+# poudriere built for the jail and ports tree.
+: ${JE_VARIANT_REPO:=${POUDRIERE_DATA}/packages/${JAILNAME}-${PTNAME:-default}${SETNAME:+-${SETNAME}}}
+
 # create temporary pool
 _zfs_create_zpool() {
 	truncate -s ${IMAGESIZE} ${WRKDIR}/raw.img;
@@ -45,7 +54,7 @@ zfs_prepare() {
 
 		zfs create -o canmount=off -o mountpoint=none ${ZFS_JEROOT}
 		zfs create -o mountpoint=/ ${ZFS_JEROOT}/${ZFS_BOOTFS_NAME}
-		zfs create ${ZFS_JEROOT}/${ZFS_BOOTFS_NAME}/config;
+		zfs create -o je:profile=config ${ZFS_JEROOT}/${ZFS_BOOTFS_NAME}/config;
 		;;
 	esac
 
@@ -75,13 +84,15 @@ zfs_prepare() {
 
 bootstrap_links()
 {
-	cd ${_OVERLAYDIR}
+	local world=${2:-${WRKDIR}/world}
+
+	cd ${1:-${_OVERLAYDIR}}
 	find * -type l | \
 	while read link; do
 		src=$(readlink $link);
 		
 		# nothing to shuffle around, check next link
-		if [ ! -e "${WRKDIR}/world/$link" ]; then
+		if [ ! -e "${world}/$link" ]; then
 			continue;
 		fi
 
@@ -91,21 +102,158 @@ bootstrap_links()
 			continue;
 		fi
 
-		# remove ${WRKDIR}/world/$link to avoid clashing when the
+		# remove ${world}/$link to avoid clashing when the
 		# overlay directory is copied in - for example, cp will
 		# complain when copying a symbolic link over an existing
 		# directory.
 		if [ ${je_update} -eq 0 ]; then
 		        msg "[jail environment] moving $link to $src"
 			# bootstrap config dataset with defaults
-			mkdir -p $(dirname ${WRKDIR}/world/$src)
-			cp -fRPp ${WRKDIR}/world/$link ${WRKDIR}/world/$src
-		        rm -rf ${WRKDIR}/world/$link
+			mkdir -p $(dirname ${world}/$src)
+			cp -fRPp ${world}/$link ${world}/$src
+		        rm -rf ${world}/$link
 		else
 		        msg "[jail environment] removing $link from jail environment"
-		        rm -rf ${WRKDIR}/world/$link
+		        rm -rf ${world}/$link
+		fi
+	done
+}
+
+# copy the overlay directory $1 into the world at $2
+_je_overlay()
+{
+	if command -v jectl >/dev/null 2>&1; then
+		# single pass over the overlay, no process per link
+		if [ ${je_update} -eq 0 ]; then
+			jectl overlay apply "$1" $2
+		else
+			jectl overlay apply -u "$1" $2
 		fi
+	else
+		# not sure if bootstrap is necessary
+		(bootstrap_links "$1" $2)
+		cp -fRPp "$1/" $2/
+	fi
+}
+
+# record the content manifest of the world at $1 and print its digest.
+# `jectl verify` checks jail environments against it. The manifest is
+# part of the world, so its own digest goes in je:manifest.
+_je_manifest()
+{
+	mkdir -p $1/var/db
+	rm -f $1/var/db/jectl.mtree
+	mtree -c -x -k type,link,sha256digest -p $1 | \
+	    mtree -C -S -k type,link,sha256digest > $1.mtree || return 1
+	mv $1.mtree $1/var/db/jectl.mtree
+	sha256 -q $1/var/db/jectl.mtree
+}
+
+# set the je: properties on dataset $1, built with overlay directory $2
+# and package list $3, with manifest digest $4
+_je_props()
+{
+	# not quite a fingerprint
+	zfs set je:version="${jail_version}" $1
+	zfs set je:poudriere:jailname="${JAILNAME}" $1
+	zfs set je:poudriere:overlaydir="$2" $1
+	zfs set je:poudriere:packagelist="$3" $1
+	zfs set je:poudriere:freebsd_version="${freebsd_version}" $1
+	zfs set je:manifest="$4" $1
+}
+
+# Build variant $1 with package list $2 and overlay directory $3 on a
+# clone of the world. Run in the background, one per variant.
+_je_variant()
+{
+	local ds mnt manifest rc
+
+	ds=${ZFS_POOL_NAME}/variant/$1
+	mnt=${WRKDIR}/variant-$1
+
+	zfs clone -o canmount=noauto -o mountpoint=none ${JE_WORLD_SNAP} ${ds} || return 1
+	mkdir -p ${mnt}
+	mount -t zfs ${ds} ${mnt} || return 1
+
+	rc=0
+	if [ -n "$2" ]; then
+		msg "[jail environment] $1: installing packages from $2"
+		env ASSUME_ALWAYS_YES=yes REPOS_DIR=${WRKDIR}/variant-repos \
+		    pkg -r ${mnt} install $(grep -v '^#' "$2") >/dev/null || rc=1
+	fi
+	if [ ${rc} -eq 0 -a -d "$3" ]; then
+		msg "[jail environment] $1: copying in overlay directory from $3"
+		_je_overlay "$3" ${mnt} || rc=1
+	fi
+	if [ ${rc} -eq 0 ]; then
+		manifest=$(_je_manifest ${mnt}) || rc=1
+	fi
+
+	umount ${mnt}
+	rmdir ${mnt}
+	[ ${rc} -eq 0 ] || return 1
+
+	_je_props ${ds} "$3" "$2" "${manifest}"
+}
+
+# Build the JE_VARIANTS from the world in $1. It is snapshotted with the
+# name of the stream, the variants are cloned from that snapshot and
+# built concurrently.
+_je_build_variants()
+{
+	local variant name pids pid rc
+
+	JE_WORLD_SNAP=$1@${SNAPSHOT_NAME:=${IMAGENAME}}
+	zfs snapshot ${JE_WORLD_SNAP} || return 1
+	zfs create -o canmount=off -o mountpoint=none ${ZFS_POOL_NAME}/variant || return 1
+
+	mkdir -p ${WRKDIR}/variant-repos
+	cat > ${WRKDIR}/variant-repos/je.conf <<-EOF
+	je: {
+		url: "file://${JE_VARIANT_REPO}",
+		enabled: yes
+	}
+	EOF
+
+	pids=
+	for variant in ${JE_VARIANTS}; do
+		name=${variant%%:*}
+		_je_variant ${name} "$(echo "${variant}::" | cut -d : -f 2)" \
+		    "$(echo "${variant}::" | cut -d : -f 3)" &
+		pids="${pids} $!"
+	done
+
+	rc=0
+	for pid in ${pids}; do
+		wait ${pid} || rc=1
+	done
+
+	return ${rc}
+}
+
+# One incremental stream per variant, relative to the world snapshot the
+# stream of $1 is sent from. `jectl import` receives them as clones of it,
+# so it has to be imported first.
+_je_send_variants()
+{
+	local variant name snap pids pid rc
+
+	pids=
+	for variant in ${JE_VARIANTS}; do
+		name=${variant%%:*}
+		snap=${ZFS_POOL_NAME}/variant/${name}@${SNAPSHOT_NAME}
+		msg "[jail environment] ${name}: writing ${IMAGENAME}-${name}.je.zfs"
+		zfs snapshot ${snap} || return 1
+		zfs send -p -e -i $1 ${snap} > ${OUTPUTDIR}/${IMAGENAME}-${name}.je.zfs &
+		pids="${pids} $!"
+	done
+
+	rc=0
+	for pid in ${pids}; do
+		wait ${pid} || rc=1
 	done
+
+	return ${rc}
 }
 
 zfs_build() {
@@ -123,32 +271,46 @@ zfs_build() {
 	fi
 
 	if [ -d "${_OVERLAYDIR}" ]; then
-		# not sure if bootstrap is necessary
-		(bootstrap_links)
-
 		msg "[jail environment] copying in overlay directory from ${_OVERLAYDIR}"
-		cp -fRPp "${_OVERLAYDIR}/" ${WRKDIR}/world/
+		_je_overlay "${_OVERLAYDIR}" ${WRKDIR}/world || exit
 
 		EXTRADIR=${_OVERLAYDIR}
 		_OVERLAYDIR=
 	fi
 
+	msg "[jail environment] recording content manifest"
+	je_manifest=$(_je_manifest ${WRKDIR}/world) || exit
+
+	je_ds=${zroot}/${ZFS_BOOTFS_NAME}
+
 	msg "[jail environment] setting zfs user properties" 
 
-	# not quite a fingerprint
-	zfs set je:version="${jail_version}" ${zroot}/${ZFS_BOOTFS_NAME}
-	zfs set je:poudriere:jailname="${JAILNAME}" ${zroot}/${ZFS_BOOTFS_NAME}
-	zfs set je:poudriere:overlaydir="${EXTRADIR}" ${zroot}/${ZFS_BOOTFS_NAME}
-	zfs set je:poudriere:packagelist="${PACKAGELIST}" ${zroot}/${ZFS_BOOTFS_NAME}
-	zfs set je:poudriere:freebsd_version="${freebsd_version}" ${zroot}/${ZFS_BOOTFS_NAME}
+	_je_props ${je_ds} "${EXTRADIR}" "${PACKAGELIST}" "${je_manifest}"
 
 	# dont know the final mountpoint, so none.
 	zfs set mountpoint=none canmount=off ${zroot}
-	zfs set mountpoint=none canmount=noauto ${zroot}/${ZFS_BOOTFS_NAME}
+	zfs set mountpoint=none canmount=noauto ${je_ds}
 
 	if [ $je_update -eq 0 ]; then
 		zfs set canmount=noauto ${zroot}/${ZFS_BOOTFS_NAME}/config
 	fi
+
+	if [ -n "${JE_VARIANTS}" ]; then
+		if [ ${je_update} -eq 0 ]; then
+			msg "[jail environment] JE_VARIANTS needs -t zfs+send+be, ignored"
+			JE_VARIANTS=
+		else
+			msg "[jail environment] building variants: ${JE_VARIANTS}"
+			# keeps jectl import -b from replacing the snapshot
+			# the variants are sent from
+			names=
+			for variant in ${JE_VARIANTS}; do
+				names="${names:+${names} }${variant%%:*}"
+			done
+			zfs set je:poudriere:variants="${names}" ${je_ds}
+			_je_build_variants ${je_ds} || exit
+		fi
+	fi
 }
 
 zfs_generate()
@@ -171,10 +333,16 @@ zfs_generate()
 
 	else
 		BESNAPSPEC="${ZFS_JEROOT}/${ZFS_BOOTFS_NAME}@${SNAPSHOT_NAME}"
-		zfs snapshot "$BESNAPSPEC"
+		# taken already when there are variants
+		zfs list -H -t snapshot "$BESNAPSPEC" >/dev/null 2>&1 ||
+		    zfs snapshot "$BESNAPSPEC"
 
 		FINALIMAGE=${IMAGENAME}.je.zfs
 		_zfs_writereplicationstream "${BESNAPSPEC}" "${FINALIMAGE}"
+
+		if [ -n "${JE_VARIANTS}" ]; then
+			_je_send_variants "${BESNAPSPEC}" || exit
+		fi
 	fi
 
 	zpool export ${ZFS_POOL_NAME}
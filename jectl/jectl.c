@@ -0,0 +1,145 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jectl.h"
+
+libjectl_handle_t *jh;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jectl [-e jepool[,jepool...]] [-j jeroot[,jeroot...]]\n");
+	fprintf(stderr, "             [-p first|spread] <command> ...\n\n");
+	fprintf(stderr, "Commands:\n");
+	fprintf(stderr, "    activate <jailname> <jailenv>	- activate jail environment\n");
+	fprintf(stderr, "    du [-Hp] [jailname]			- unique and shared space\n");
+	fprintf(stderr, "    dump [--json] [jailname]		- print detailed information\n");
+	fprintf(stderr, "    import [-b] [-l ms] [-r n] <name>	- receive ZFS replication stream\n");
+	fprintf(stderr, "    list [-Hjp] [-o col] [-s col | -S col] [jailname]\n");
+	fprintf(stderr, "					- list jails and jail environments\n");
+	fprintf(stderr, "    metrics [-o file]			- print OpenMetrics text\n");
+	fprintf(stderr, "    mount <jailname> <mountpoint>	- mount jail at given path\n");
+	fprintf(stderr, "    overlay apply [-u] <dir> <world>	- copy overlay into world\n");
+	fprintf(stderr, "    pool fill [-s size] [-t jailenv]	- keep ready jail datasets\n");
+	fprintf(stderr, "    pool take <jailname> <mountpoint>	- mount a ready jail dataset as jail\n");
+	fprintf(stderr, "    prewarm record <jailname>		- record files used by a running jail\n");
+	fprintf(stderr, "    prewarm run <jailname> <path>	- read recorded files below path\n");
+	fprintf(stderr, "    profile list			- print property profiles\n");
+	fprintf(stderr, "    profile report [-Hp]		- compression by profile\n");
+	fprintf(stderr, "    snapshot [-k n] -a|<jailname ...>	- snapshot persistent datasets\n");
+	fprintf(stderr, "    umount <jailname>			- unmount jail\n");
+	fprintf(stderr, "    update <jailname> [mountpoint]	- update jail and optionally mount\n");
+	fprintf(stderr, "    verify [-i] <jailname|jailenv>	- check files against the manifest\n");
+	fprintf(stderr, "\nOptions:\n");
+	fprintf(stderr, "    -e jepool		- roots holding jail environments (JECTL_JEPOOL)\n");
+	fprintf(stderr, "    -j jeroot		- roots holding jail datasets (JECTL_JEROOT)\n");
+	fprintf(stderr, "    -p policy		- placement of new datasets (JECTL_PLACEMENT)\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, error;
+	const char *jepools, *jeroots, *placement;
+	struct jectl_command **jc;
+
+	/* environment first, so that flags can override it */
+	jepools = getenv("JECTL_JEPOOL");
+	jeroots = getenv("JECTL_JEROOT");
+	placement = getenv("JECTL_PLACEMENT");
+
+	while ((c = getopt(argc, argv, "e:j:p:")) != -1) {
+		switch (c) {
+		case 'e':
+			jepools = optarg;
+			break;
+		case 'j':
+			jeroots = optarg;
+			break;
+		case 'p':
+			placement = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1)
+		usage();
+
+	/* sub-commands do their own getopt(3) parsing */
+	optreset = 1;
+	optind = 1;
+
+	SET_FOREACH(jc, jectl) {
+		if (strcmp((*jc)->name, argv[0]) == 0)
+			break;
+	}
+
+	if (jc == SET_LIMIT(jectl)) {
+		fprintf(stderr, "jectl: sub-command not found: %s\n", argv[0]);
+		return (1);
+	}
+
+	/* e.g. helpers run by generate-je.sh on a poudriere host */
+	if (((*jc)->flags & JE_CMD_NOZFS) != 0)
+		return ((*jc)->handler(argc, argv));
+
+	if ((jh = libjectl_init()) == NULL) {
+		fprintf(stderr, "jectl: cannot initialize libjectl\n");
+		return (1);
+	}
+
+	libjectl_print_on_error(jh, true);
+	libjectl_set_verbose(jh, true);
+
+	if ((jepools != NULL &&
+	    libjectl_set_roots(jh, JE_ROOT_JEPOOL, jepools) != 0) ||
+	    (jeroots != NULL &&
+	    libjectl_set_roots(jh, JE_ROOT_JEROOT, jeroots) != 0) ||
+	    (placement != NULL && libjectl_set_placement(jh, placement) != 0) ||
+	    libjectl_create_roots(jh) != 0) {
+		libjectl_close(jh);
+		return (1);
+	}
+
+	error = (*jc)->handler(argc, argv);
+
+	libjectl_close(jh);
+	return (error);
+}
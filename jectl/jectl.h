@@ -25,36 +25,30 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
-
 #include <sys/cdefs.h>
 #include <sys/linker_set.h>
+#include <stdbool.h>
+
+#include <libjectl.h>
 
 struct jectl_command {
 	const char *name;
 	int (*handler)(int argc, char **argv);
+	int flags;
 };
 
+#define	JE_CMD_NOZFS	0x1	/* runs without jh and its roots */
+
 SET_DECLARE(jectl, struct jectl_command);
 
 #define JE_COMMAND(set, name, function)				\
+	JE_COMMAND_FLAGS(set, name, function, 0)
+
+#define JE_COMMAND_FLAGS(set, name, function, flags)		\
 	static struct jectl_command name ## _jectl_command =	\
-	{ #name, function };					\
+	{ #name, function, flags };				\
 	DATA_SET(set, name ## _jectl_command);
 
-extern libzfs_handle_t *lzh;
-extern const char *jepool;
-extern const char *jeroot;
-
-int get_property(zfs_handle_t *, const char *, char **);
-
-zfs_handle_t * get_jail_dataset(const char *);
-zfs_handle_t * get_active_je(zfs_handle_t *);
-
-zfs_handle_t * je_copy(zfs_handle_t *, zfs_handle_t *);
-
-int je_activate(zfs_handle_t *, const char *);
-int je_destroy(zfs_handle_t *);
-int je_mount(zfs_handle_t *, const char *);
-int je_swapin(zfs_handle_t *, zfs_handle_t *);
-int je_unmount(zfs_handle_t *, int);
+extern libjectl_handle_t *jh;
 
+void jectl_prewarm_background(const char *, const char *);
@@ -25,70 +25,19 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
-#include <libzfs_impl.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "jectl.h"
 
-static zfs_handle_t *
-search_jepool(const char *target)
-{
-	char name[ZFS_MAXPROPLEN];
-
-	snprintf(name, sizeof(name), "%s/%s", jepool, target);
-
-	if (!zfs_dataset_exists(lzh, name, ZFS_TYPE_FILESYSTEM))
-		return (NULL);
-
-	return (zfs_open(lzh, name, ZFS_TYPE_FILESYSTEM));
-}
-
-int
-je_activate(zfs_handle_t *jds, const char *target)
-{
-	int error;
-	char name[ZFS_MAXPROPLEN];
-	zfs_handle_t *next, *zhp;
-
-	snprintf(name, sizeof(name), "%s/%s", zfs_get_name(jds), target);
-
-	if (zfs_dataset_exists(lzh, name, ZFS_TYPE_FILESYSTEM)) {
-		next = zfs_open(lzh, name, ZFS_TYPE_FILESYSTEM);
-	} else {
-		if ((zhp = search_jepool(target)) == NULL)
-			return (1);
-		next = je_copy(zhp, jds);
-	}
-
-	if (next == NULL)
-		return (1);
-
-	error = je_swapin(jds, next);
-
-	zfs_close(next);
-
-	return (error);
-}
-
-
 static int
 jectl_activate(int argc, char **argv)
 {
-	int error;
-	zfs_handle_t *jds;
-
 	if (argc != 3) {
 		fprintf(stderr, "usage: jectl activate <jailname> <jailenv>\n");
 		exit(1);
 	}
 
-	if ((jds = get_jail_dataset(argv[1])) == NULL)
-		return (1);
-
-	error = je_activate(jds, argv[2]);
-
-	zfs_close(jds);
-
-	return (error);
+	return (je_activate(jh, argv[1], argv[2]) != 0);
 }
 JE_COMMAND(jectl, activate, jectl_activate);
-
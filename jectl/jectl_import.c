@@ -0,0 +1,87 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <libutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "jectl.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jectl import [-b] [-l latency] [-r rate] <jailname|jailenv>\n");
+	exit(1);
+}
+
+/*
+ * -r limits the stream to rate bytes per second (k, m, g suffixes).
+ * -l enables adaptive throttling: the rate backs off while the average
+ *    I/O latency of the destination pool is above latency milliseconds.
+ * -b rebases a jail environment onto the closest one already imported.
+ */
+static int
+jectl_import(int argc, char **argv)
+{
+	int c, flags;
+	uint64_t rate, latency;
+	char *end;
+
+	rate = latency = 0;
+	flags = 0;
+
+	while ((c = getopt(argc, argv, "bl:r:")) != -1) {
+		switch (c) {
+		case 'b':
+			flags |= JE_IMPORT_REBASE;
+			break;
+		case 'l':
+			latency = strtoull(optarg, &end, 10);
+			if (*end != '\0' || latency == 0)
+				usage();
+			latency *= 1000000;
+			break;
+		case 'r':
+			if (expand_number(optarg, &rate) != 0 || rate == 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		usage();
+
+	return (je_import(jh, STDIN_FILENO, argv[0], flags, rate,
+	    latency) != 0);
+}
+JE_COMMAND(jectl, import, jectl_import);
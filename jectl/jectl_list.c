@@ -0,0 +1,87 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "jectl.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jectl list [-Hjp] [-o column[,...]] "
+	    "[-s column | -S column] [jailname]\n");
+	exit(1);
+}
+
+static int
+jectl_list(int argc, char **argv)
+{
+	int c, flags;
+	const char *columns, *sort;
+
+	flags = 0;
+	columns = NULL;
+	sort = NULL;
+	while ((c = getopt(argc, argv, "Hjo:pS:s:")) != -1) {
+		switch (c) {
+		case 'H':
+			flags |= JE_LIST_SCRIPTED;
+			break;
+		case 'j':
+			flags |= JE_LIST_JSON;
+			break;
+		case 'o':
+			columns = optarg;
+			break;
+		case 'p':
+			flags |= JE_LIST_PARSABLE;
+			break;
+		case 'S':
+			flags |= JE_LIST_REVERSE;
+			sort = optarg;
+			break;
+		case 's':
+			flags &= ~JE_LIST_REVERSE;
+			sort = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		usage();
+
+	return (je_list(jh, argc == 1 ? argv[0] : NULL, columns, sort, flags,
+	    stdout) != 0);
+}
+JE_COMMAND(jectl, list, jectl_list);
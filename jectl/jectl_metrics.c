@@ -0,0 +1,95 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jectl.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jectl metrics [-o file]\n");
+	exit(1);
+}
+
+/*
+ * -o writes to a temporary file renamed over file, so a textfile
+ * collector never reads a partial scrape.
+ */
+static int
+jectl_metrics(int argc, char **argv)
+{
+	int c, error;
+	FILE *fp;
+	char *output;
+	char tmp[MAXPATHLEN];
+
+	output = NULL;
+	while ((c = getopt(argc, argv, "o:")) != -1) {
+		switch (c) {
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc != optind)
+		usage();
+
+	if (output == NULL)
+		return (je_metrics(jh, stdout) != 0);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", output);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		fprintf(stderr, "jectl: cannot open %s: %s\n", tmp, strerror(errno));
+		return (1);
+	}
+
+	error = je_metrics(jh, fp);
+	if (fclose(fp) != 0 && error == 0) {
+		fprintf(stderr, "jectl: cannot write %s: %s\n", tmp,
+		    strerror(errno));
+		error = 1;
+	}
+	if (error == 0 && rename(tmp, output) != 0) {
+		fprintf(stderr, "jectl: cannot rename %s: %s\n", tmp,
+		    strerror(errno));
+		error = 1;
+	}
+	if (error != 0)
+		unlink(tmp);
+
+	return (error != 0);
+}
+JE_COMMAND(jectl, metrics, jectl_metrics);
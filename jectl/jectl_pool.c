@@ -0,0 +1,115 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jectl.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jectl pool fill [-s size] [-t jailenv]\n");
+	fprintf(stderr, "       jectl pool take <jailname> <mountpoint>\n");
+	exit(1);
+}
+
+/* top the pool up again without holding up the jail that was taken */
+static void
+jectl_pool_refill(void)
+{
+	switch (fork()) {
+	case -1:
+		return;
+	case 0:
+		setsid();
+		je_pool_fill(jh, NULL, -1);
+		_exit(0);
+	default:
+		return;
+	}
+}
+
+static int
+jectl_pool_fill(int argc, char **argv)
+{
+	int c;
+	long size;
+	const char *template;
+	char *end;
+
+	size = -1;
+	template = NULL;
+	while ((c = getopt(argc, argv, "s:t:")) != -1) {
+		switch (c) {
+		case 's':
+			size = strtol(optarg, &end, 10);
+			if (*end != '\0' || size < 0)
+				usage();
+			break;
+		case 't':
+			template = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	return (je_pool_fill(jh, template, size) != 0);
+}
+
+static int
+jectl_pool(int argc, char **argv)
+{
+	if (argc < 2)
+		usage();
+
+	argc--;
+	argv++;
+
+	if (strcmp(argv[0], "fill") == 0)
+		return (jectl_pool_fill(argc, argv));
+
+	if (strcmp(argv[0], "take") != 0 || argc != 3)
+		usage();
+
+	if (je_pool_take(jh, argv[1], argv[2]) != 0)
+		return (1);
+
+	jectl_pool_refill();
+
+	return (0);
+}
+JE_COMMAND(jectl, pool, jectl_pool);
@@ -0,0 +1,83 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jectl.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jectl prewarm record <jailname>\n");
+	fprintf(stderr, "       jectl prewarm run <jailname> <mountpoint>\n");
+	exit(1);
+}
+
+/*
+ * Prewarm in a child process so that starting the jail is not held up,
+ * the jail's own reads race with the prefetch and both benefit.
+ */
+void
+jectl_prewarm_background(const char *jail, const char *root)
+{
+	/* no manifest recorded, nothing to do */
+	if (!je_prewarm_recorded(jh, jail))
+		return;
+
+	switch (fork()) {
+	case -1:
+		return;
+	case 0:
+		setsid();
+		je_prewarm(jh, jail, root);
+		_exit(0);
+	default:
+		return;
+	}
+}
+
+static int
+jectl_prewarm(int argc, char **argv)
+{
+	int error;
+
+	if (argc < 3)
+		usage();
+
+	if (strcmp(argv[1], "record") == 0 && argc == 3)
+		error = je_prewarm_record(jh, argv[2]);
+	else if (strcmp(argv[1], "run") == 0 && argc == 4)
+		error = je_prewarm(jh, argv[2], argv[3]);
+	else
+		usage();
+
+	return (error != 0);
+}
+JE_COMMAND(jectl, prewarm, jectl_prewarm);
@@ -0,0 +1,82 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jectl.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: jectl profile list\n");
+	fprintf(stderr, "       jectl profile report [-Hp]\n");
+	exit(1);
+}
+
+static int
+jectl_profile(int argc, char **argv)
+{
+	int c, flags;
+
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "list") == 0) {
+		if (argc != 2)
+			usage();
+		return (je_profile_list(jh, stdout) != 0);
+	}
+
+	if (strcmp(argv[1], "report") != 0)
+		usage();
+
+	argc--;
+	argv++;
+
+	flags = 0;
+	while ((c = getopt(argc, argv, "Hp")) != -1) {
+		switch (c) {
+		case 'H':
+			flags |= JE_PROFILE_SCRIPTED;
+			break;
+		case 'p':
+			flags |= JE_PROFILE_PARSABLE;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc != optind)
+		usage();
+
+	return (je_profile_report(jh, flags, stdout) != 0);
+}
+JE_COMMAND(jectl, profile, jectl_profile);
@@ -25,7 +25,11 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
-#include <libzfs_impl.h>
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "jectl.h"
 
@@ -36,25 +40,11 @@ usage(void)
 	exit(1);
 }
 
-/*
- * unmount zhp and child datasets inheriting zhp's mountpoint
- */
-int
-je_unmount(zfs_handle_t *zhp, int flags)
-{
-	if (!zfs_is_mounted(zhp, NULL))
-		return (0);
-
-	return (zfs_unmountall(zhp, flags));
-}
-
 static int
 jectl_unmount(int argc, char **argv)
 {
 	int c;
-	int error;
 	int flags = 0;
-	zfs_handle_t *je, *jds;
 
 	while ((c = getopt(argc, argv, "f")) != -1) {
 		switch (c) {
@@ -74,19 +64,6 @@ jectl_unmount(int argc, char **argv)
 		usage();
 	}
 
-	if ((jds = get_jail_dataset(argv[0])) == NULL)
-		return (1);
-
-	if ((je = get_active_je(jds)) == NULL) {
-		zfs_close(jds);
-		return (1);
-	}
-
-	error = je_unmount(je, flags);
-
-	zfs_close(je);
-	zfs_close(jds);
-
-	return (error);
+	return (je_unmount(jh, argv[0], flags) != 0);
 }
 JE_COMMAND(jectl, umount, jectl_unmount);
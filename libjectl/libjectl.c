@@ -0,0 +1,328 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdarg.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+static const char *default_jepool = "zroot/JE";
+static const char *default_jeroot = "zroot/JAIL";
+
+/*
+ * Initialize a handle, with a libzfs handle of its own and the default
+ * roots, zroot/JE and zroot/JAIL.
+ */
+libjectl_handle_t *
+libjectl_init(void)
+{
+	libjectl_handle_t *hdl;
+
+	if ((hdl = calloc(1, sizeof(*hdl))) == NULL)
+		return (NULL);
+
+	if ((hdl->lzh = libzfs_init()) == NULL) {
+		free(hdl);
+		return (NULL);
+	}
+
+	hdl->jepools[0] = default_jepool;
+	hdl->jeroots[0] = default_jeroot;
+	hdl->njepools = 1;
+	hdl->njeroots = 1;
+	hdl->placement = JE_PLACE_FIRST;
+
+	return (hdl);
+}
+
+/*
+ * A handle for a worker thread, with a libzfs handle of its own and the
+ * roots and settings of hdl, which has to outlive it.
+ */
+libjectl_handle_t *
+je_handle_dup(libjectl_handle_t *hdl)
+{
+	libjectl_handle_t *dup;
+
+	if ((dup = libjectl_init()) == NULL)
+		return (NULL);
+
+	memcpy(dup->jepools, hdl->jepools, sizeof(dup->jepools));
+	memcpy(dup->jeroots, hdl->jeroots, sizeof(dup->jeroots));
+	dup->njepools = hdl->njepools;
+	dup->njeroots = hdl->njeroots;
+	dup->placement = hdl->placement;
+	dup->verbose = hdl->verbose;
+	libjectl_print_on_error(dup, hdl->print_on_error);
+
+	return (dup);
+}
+
+void
+libjectl_close(libjectl_handle_t *hdl)
+{
+	if (hdl == NULL)
+		return;
+
+	je_guidmap_free(hdl);
+	je_mnttab_flush(hdl);
+	libzfs_fini(hdl->lzh);
+	free(hdl->jepools_buf);
+	free(hdl->jeroots_buf);
+	free(hdl);
+}
+
+/*
+ * Record an error on the handle, printed right away when print_on_error
+ * is set. Returns the error so callers can `return (je_error(...))`.
+ */
+int
+je_error(libjectl_handle_t *hdl, je_error_t error, const char *fmt, ...)
+{
+	va_list ap;
+
+	hdl->error = error;
+
+	va_start(ap, fmt);
+	vsnprintf(hdl->errbuf, sizeof(hdl->errbuf), fmt, ap);
+	va_end(ap);
+
+	if (hdl->print_on_error)
+		fprintf(stderr, "jectl: %s\n", hdl->errbuf);
+
+	return (error);
+}
+
+/*
+ * Warnings about work that was done only in part, printed like errors
+ * but without recording one on the handle.
+ */
+void
+je_warn(libjectl_handle_t *hdl, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!hdl->print_on_error)
+		return;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "jectl: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+/* informational messages, printed when verbose is set */
+void
+je_info(libjectl_handle_t *hdl, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!hdl->verbose)
+		return;
+
+	va_start(ap, fmt);
+	printf("jectl: ");
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+je_error_t
+libjectl_errcode(libjectl_handle_t *hdl)
+{
+	return (hdl->error);
+}
+
+const char *
+libjectl_error_description(libjectl_handle_t *hdl)
+{
+	if (hdl->error == JE_ERR_SUCCESS)
+		return ("no error");
+
+	return (hdl->errbuf);
+}
+
+void
+libjectl_print_on_error(libjectl_handle_t *hdl, bool doprint)
+{
+	hdl->print_on_error = doprint;
+	libzfs_print_on_error(hdl->lzh, doprint);
+}
+
+void
+libjectl_set_verbose(libjectl_handle_t *hdl, bool verbose)
+{
+	hdl->verbose = verbose;
+}
+
+/*
+ * End of a batch of operations: cached state that others may change
+ * behind our back, the mount table and the snapshot guids, is dropped
+ * and taken again when next needed.
+ */
+void
+libjectl_flush(libjectl_handle_t *hdl)
+{
+	je_guidmap_free(hdl);
+	je_mnttab_flush(hdl);
+}
+
+/*
+ * set the roots of the given type from a comma separated list of datasets
+ */
+int
+libjectl_set_roots(libjectl_handle_t *hdl, je_root_t type, const char *list)
+{
+	const char **roots;
+	const char *newroots[JE_MAXROOTS];
+	char *buf, *p, *root;
+	int count, *countp;
+
+	if ((buf = strdup(list)) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	count = 0;
+	p = buf;
+	while ((root = strsep(&p, ",")) != NULL) {
+		if (*root == '\0')
+			continue;
+		if (count == JE_MAXROOTS) {
+			free(buf);
+			return (je_error(hdl, JE_ERR_TOOMANYROOTS,
+			    "too many roots, maximum is %d", JE_MAXROOTS));
+		}
+		newroots[count++] = root;
+	}
+
+	if (count == 0) {
+		free(buf);
+		return (je_error(hdl, JE_ERR_INVALIDARG, "empty root list"));
+	}
+
+	if (type == JE_ROOT_JEPOOL) {
+		roots = hdl->jepools;
+		countp = &hdl->njepools;
+		free(hdl->jepools_buf);
+		hdl->jepools_buf = buf;
+	} else {
+		roots = hdl->jeroots;
+		countp = &hdl->njeroots;
+		free(hdl->jeroots_buf);
+		hdl->jeroots_buf = buf;
+	}
+
+	memcpy(roots, newroots, count * sizeof(*roots));
+	*countp = count;
+
+	/* snapshots below the old roots are of no interest */
+	je_guidmap_free(hdl);
+
+	return (JE_ERR_SUCCESS);
+}
+
+/* roots of the given type, the first one is the default */
+int
+libjectl_get_roots(libjectl_handle_t *hdl, je_root_t type,
+    const char * const **roots)
+{
+	if (type == JE_ROOT_JEPOOL) {
+		*roots = hdl->jepools;
+		return (hdl->njepools);
+	}
+
+	*roots = hdl->jeroots;
+	return (hdl->njeroots);
+}
+
+int
+libjectl_set_placement(libjectl_handle_t *hdl, const char *policy)
+{
+	if (strcmp(policy, "first") == 0)
+		hdl->placement = JE_PLACE_FIRST;
+	else if (strcmp(policy, "spread") == 0)
+		hdl->placement = JE_PLACE_SPREAD;
+	else
+		return (je_error(hdl, JE_ERR_INVALIDARG,
+		    "unknown placement policy: %s", policy));
+
+	return (JE_ERR_SUCCESS);
+}
+
+static int
+create_roots(libjectl_handle_t *hdl, const char **roots, int count,
+    nvlist_t *nvl)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (zfs_dataset_exists(hdl->lzh, roots[i], ZFS_TYPE_FILESYSTEM))
+			continue;
+		if (zfs_create(hdl->lzh, roots[i], ZFS_TYPE_FILESYSTEM, nvl) != 0)
+			return (je_error(hdl, JE_ERR_ZFSCREATE,
+			    "cannot create %s", roots[i]));
+		je_info(hdl, "created %s", roots[i]);
+	}
+
+	return (JE_ERR_SUCCESS);
+}
+
+/* create the roots that do not exist yet, unmounted */
+int
+libjectl_create_roots(libjectl_handle_t *hdl)
+{
+	int error;
+	nvlist_t *nvl;
+
+	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+	nvlist_add_string(nvl, "canmount", "off");
+	nvlist_add_string(nvl, "mountpoint", "none");
+
+	error = create_roots(hdl, hdl->jeroots, hdl->njeroots, nvl);
+	if (error == 0)
+		error = create_roots(hdl, hdl->jepools, hdl->njepools, nvl);
+
+	nvlist_free(nvl);
+	return (error);
+}
+
+/* name of the dataset of the given jail */
+int
+je_jail_dataset(libjectl_handle_t *hdl, const char *jail, char *buf,
+    size_t len)
+{
+	zfs_handle_t *jds;
+
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (hdl->error);
+
+	strlcpy(buf, zfs_get_name(jds), len);
+	zfs_close(jds);
+
+	return (JE_ERR_SUCCESS);
+}
@@ -0,0 +1,149 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LIBJECTL_H
+#define _LIBJECTL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * libjectl keeps all of its state in a handle. A handle must not be used
+ * by more than one thread at a time; threads that each use their own
+ * handle do not interfere with each other.
+ */
+typedef struct libjectl_handle libjectl_handle_t;
+
+typedef enum je_error {
+	JE_ERR_SUCCESS = 0,	/* operation successful */
+	JE_ERR_INVALIDARG,	/* invalid argument */
+	JE_ERR_TOOMANYROOTS,	/* more than JE_MAXROOTS roots */
+	JE_ERR_NOJAIL,		/* jail dataset does not exist */
+	JE_ERR_NOACTIVE,	/* jail has no active jail environment */
+	JE_ERR_NOENT,		/* jail environment does not exist */
+	JE_ERR_EXISTS,		/* dataset already exists */
+	JE_ERR_NOSPACE,		/* not enough space in the destination */
+	JE_ERR_ZFSOPEN,		/* cannot open a dataset */
+	JE_ERR_ZFSCREATE,	/* cannot create a dataset */
+	JE_ERR_ZFSCLONE,	/* cannot snapshot or clone a dataset */
+	JE_ERR_ZFSRENAME,	/* cannot rename a dataset */
+	JE_ERR_ZFSPROP,		/* cannot set a property */
+	JE_ERR_MOUNT,		/* cannot mount a dataset */
+	JE_ERR_UNMOUNT,		/* cannot unmount a dataset */
+	JE_ERR_STREAM,		/* invalid or unreadable send stream */
+	JE_ERR_RECEIVE,		/* zfs receive failed */
+	JE_ERR_NOMEM,		/* out of memory */
+	JE_ERR_IO,		/* I/O error outside of ZFS */
+	JE_ERR_VERIFY,		/* contents differ from the manifest */
+	JE_ERR_UNKNOWN,		/* unknown error */
+} je_error_t;
+
+/* root types */
+typedef enum je_root {
+	JE_ROOT_JEPOOL,		/* roots holding jail environments */
+	JE_ROOT_JEROOT,		/* roots holding jail datasets */
+} je_root_t;
+
+#define	JE_MAXROOTS	8
+
+/* je_du flags */
+#define	JE_DU_SCRIPTED	0x1	/* no header, tab separated */
+#define	JE_DU_PARSABLE	0x2	/* exact byte counts */
+
+/* je_list flags */
+#define	JE_LIST_SCRIPTED	0x1	/* no header, tab separated */
+#define	JE_LIST_PARSABLE	0x2	/* exact values */
+#define	JE_LIST_JSON		0x4	/* a JSON object */
+#define	JE_LIST_REVERSE		0x8	/* sort descending */
+
+/* je_dump flags */
+#define	JE_DUMP_JSON	0x1	/* JSON instead of text */
+
+/* je_import flags */
+#define	JE_IMPORT_REBASE	0x1	/* share blocks with the closest JE */
+
+/* je_profile_report flags */
+#define	JE_PROFILE_SCRIPTED	0x1	/* no header, tab separated */
+#define	JE_PROFILE_PARSABLE	0x2	/* exact byte counts */
+
+/* je_verify flags */
+#define	JE_VERIFY_INCREMENTAL	0x1	/* only what changed since the origin */
+
+/* handle */
+libjectl_handle_t *libjectl_init(void);
+void libjectl_close(libjectl_handle_t *);
+int libjectl_set_roots(libjectl_handle_t *, je_root_t, const char *);
+int libjectl_get_roots(libjectl_handle_t *, je_root_t, const char * const **);
+int libjectl_set_placement(libjectl_handle_t *, const char *);
+int libjectl_create_roots(libjectl_handle_t *);
+void libjectl_flush(libjectl_handle_t *);
+
+/* errors and messages */
+je_error_t libjectl_errcode(libjectl_handle_t *);
+const char *libjectl_error_description(libjectl_handle_t *);
+void libjectl_print_on_error(libjectl_handle_t *, bool);
+void libjectl_set_verbose(libjectl_handle_t *, bool);
+
+/* jails and jail environments */
+int je_jail_dataset(libjectl_handle_t *, const char *, char *, size_t);
+int je_activate(libjectl_handle_t *, const char *, const char *);
+int je_update(libjectl_handle_t *, const char *);
+int je_mount(libjectl_handle_t *, const char *, const char *);
+int je_unmount(libjectl_handle_t *, const char *, int);
+int je_import(libjectl_handle_t *, int, const char *, int, uint64_t,
+    uint64_t);
+int je_list(libjectl_handle_t *, const char *, const char *, const char *,
+    int, FILE *);
+int je_dump(libjectl_handle_t *, const char *, int, FILE *);
+int je_du(libjectl_handle_t *, const char *, int, FILE *);
+int je_metrics(libjectl_handle_t *, FILE *);
+
+/* property profiles */
+int je_profile_list(libjectl_handle_t *, FILE *);
+int je_profile_report(libjectl_handle_t *, int, FILE *);
+
+/* snapshots of the persistent datasets */
+int je_snapshot(libjectl_handle_t *, char * const *, int, int);
+
+/* manifest verification */
+int je_verify(libjectl_handle_t *, const char *, int, FILE *);
+
+/* warm pool */
+int je_pool_fill(libjectl_handle_t *, const char *, long);
+int je_pool_take(libjectl_handle_t *, const char *, const char *);
+
+/* prewarm */
+bool je_prewarm_recorded(libjectl_handle_t *, const char *);
+int je_prewarm_record(libjectl_handle_t *, const char *);
+int je_prewarm(libjectl_handle_t *, const char *, const char *);
+
+/* poudriere overlays */
+int je_overlay_apply(libjectl_handle_t *, const char *, const char *, bool);
+
+#endif /* _LIBJECTL_H */
@@ -0,0 +1,120 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Look for target in every jepool. A jail environment living in the
+ * same pool as the jail dataset is preferred, it can be cloned rather
+ * than sent over.
+ */
+static zfs_handle_t *
+search_jepool(libjectl_handle_t *hdl, zfs_handle_t *jds, const char *target)
+{
+	int i;
+	const char *pool;
+	char name[ZFS_MAXPROPLEN];
+	zfs_handle_t *zhp, *found;
+
+	found = NULL;
+	pool = zfs_get_pool_name(jds);
+
+	for (i = 0; i < hdl->njepools; i++) {
+		snprintf(name, sizeof(name), "%s/%s", hdl->jepools[i], target);
+
+		if (!zfs_dataset_exists(hdl->lzh, name, ZFS_TYPE_FILESYSTEM))
+			continue;
+
+		if ((zhp = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+
+		if (strcmp(zfs_get_pool_name(zhp), pool) == 0) {
+			if (found != NULL)
+				zfs_close(found);
+			return (zhp);
+		}
+
+		if (found == NULL)
+			found = zhp;
+		else
+			zfs_close(zhp);
+	}
+
+	return (found);
+}
+
+int
+je_activate_impl(libjectl_handle_t *hdl, zfs_handle_t *jds, const char *target)
+{
+	int error;
+	char name[ZFS_MAXPROPLEN];
+	zfs_handle_t *next, *zhp;
+
+	snprintf(name, sizeof(name), "%s/%s", zfs_get_name(jds), target);
+
+	if (zfs_dataset_exists(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) {
+		if ((next = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+			return (je_error(hdl, JE_ERR_ZFSOPEN,
+			    "cannot open '%s'", name));
+		if (je_persistent(next)) {
+			zfs_close(next);
+			return (je_error(hdl, JE_ERR_INVALIDARG,
+			    "'%s' is a persistent dataset", name));
+		}
+	} else {
+		if ((zhp = search_jepool(hdl, jds, target)) == NULL)
+			return (je_error(hdl, JE_ERR_NOENT,
+			    "cannot find jail environment '%s'", target));
+		if ((next = je_copy(hdl, zhp, jds)) == NULL)
+			return (hdl->error);
+	}
+
+	error = je_swapin(hdl, jds, next);
+
+	zfs_close(next);
+
+	return (error);
+}
+
+/* make je, from the jail dataset or any jepool, the active one of jail */
+int
+je_activate(libjectl_handle_t *hdl, const char *jail, const char *je)
+{
+	int error;
+	zfs_handle_t *jds;
+
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (hdl->error);
+
+	error = je_activate_impl(hdl, jds, je);
+
+	zfs_close(jds);
+
+	return (error);
+}
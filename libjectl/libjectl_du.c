@@ -0,0 +1,368 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Space accounting. USED of a clone only counts the blocks it wrote since
+ * it was cloned, the blocks it still shares with its origin are charged
+ * to the origin's snapshot. For every jail environment:
+ *
+ *	unique	space freed by destroying it (used)
+ *	shared	space it references from its origin (referenced - written,
+ *		written of a clone is relative to its origin)
+ *
+ * For the jail environments in the jepools, the sources, shared is the
+ * most any one clone references from it. Everything comes from the
+ * properties libzfs fetches while iterating, in a single walk of the
+ * roots.
+ */
+struct du_entry {
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t unique;
+	uint64_t shared;
+	uint64_t referenced;
+	uint64_t clones;
+	bool active;
+};
+
+struct du_info {
+	libjectl_handle_t *hdl;
+	FILE *fp;
+	int flags;
+	struct du_entry *sources;	/* sorted by name */
+	size_t nsources;
+	size_t alloc;
+	uint64_t reclaim;		/* inactive jail environments */
+	uint64_t reclaim_snap;		/* snapshots nothing is cloned from */
+	uint64_t ninactive;
+	uint64_t nsnap;
+	uint64_t src_snaps;		/* snapshots of the source walked */
+	uint64_t src_unused;		/* those nothing is cloned from */
+	uint64_t src_unused_used;	/* and their used, summed */
+	const char *active;		/* of the jail being walked */
+	struct du_entry jail;		/* totals of the jail being walked */
+	struct du_entry *jes;		/* its jail environments */
+	size_t njes;
+	size_t jalloc;
+};
+
+static int
+du_compare(const void *a, const void *b)
+{
+	const struct du_entry *da = a, *db = b;
+
+	return (strcmp(da->name, db->name));
+}
+
+static void
+du_print(struct du_info *di, const char *name, const char *type,
+    const struct du_entry *de)
+{
+	char unique[32], shared[32], referenced[32];
+
+	if ((di->flags & JE_DU_PARSABLE) != 0) {
+		snprintf(unique, sizeof(unique), "%ju", (uintmax_t)de->unique);
+		snprintf(shared, sizeof(shared), "%ju", (uintmax_t)de->shared);
+		snprintf(referenced, sizeof(referenced), "%ju",
+		    (uintmax_t)de->referenced);
+	} else {
+		zfs_nicenum(de->unique, unique, sizeof(unique));
+		zfs_nicenum(de->shared, shared, sizeof(shared));
+		zfs_nicenum(de->referenced, referenced, sizeof(referenced));
+	}
+
+	if ((di->flags & JE_DU_SCRIPTED) != 0)
+		fprintf(di->fp, "%s\t%s\t%s\t%s\t%s\n", name, type, unique,
+		    shared, referenced);
+	else
+		fprintf(di->fp, "%-40s %-7s %8s %8s %8s\n", name, type, unique,
+		    shared, referenced);
+}
+
+static void
+du_fill(zfs_handle_t *zhp, struct du_entry *de)
+{
+	char origin[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t written;
+
+	strlcpy(de->name, zfs_get_name(zhp), sizeof(de->name));
+	de->unique = zfs_prop_get_int(zhp, ZFS_PROP_USED);
+	de->referenced = zfs_prop_get_int(zhp, ZFS_PROP_REFERENCED);
+	de->shared = 0;
+	de->clones = 0;
+
+	if (zfs_prop_get(zhp, ZFS_PROP_ORIGIN, origin, sizeof(origin), NULL,
+	    NULL, 0, B_FALSE) == 0 && *origin != '\0') {
+		written = zfs_prop_get_int(zhp, ZFS_PROP_WRITTEN);
+		if (de->referenced > written)
+			de->shared = de->referenced - written;
+	}
+}
+
+/* the source zhp was cloned from, NULL if not a clone of a source */
+static struct du_entry *
+du_source(struct du_info *di, zfs_handle_t *zhp)
+{
+	struct du_entry key;
+	char *at;
+
+	if (zfs_prop_get(zhp, ZFS_PROP_ORIGIN, key.name, sizeof(key.name),
+	    NULL, NULL, 0, B_FALSE) != 0 || (at = strchr(key.name, '@')) == NULL)
+		return (NULL);
+	*at = '\0';
+
+	return (bsearch(&key, di->sources, di->nsources, sizeof(key),
+	    du_compare));
+}
+
+static int
+du_source_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct du_info *di = arg;
+
+	if (di->nsources == di->alloc) {
+		di->alloc = di->alloc == 0 ? 64 : di->alloc * 2;
+		di->sources = reallocf(di->sources,
+		    di->alloc * sizeof(*di->sources));
+		if (di->sources == NULL) {
+			di->nsources = di->alloc = 0;
+			zfs_close(zhp);
+			return (ENOMEM);
+		}
+	}
+
+	du_fill(zhp, &di->sources[di->nsources++]);
+	zfs_close(zhp);
+	return (0);
+}
+
+static int
+du_je_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct du_info *di = arg;
+	struct du_entry *de, *src;
+
+	/* counted with the jail */
+	if (je_persistent(zhp)) {
+		zfs_close(zhp);
+		return (0);
+	}
+
+	if (di->njes == di->jalloc) {
+		di->jalloc = di->jalloc == 0 ? 16 : di->jalloc * 2;
+		di->jes = reallocf(di->jes, di->jalloc * sizeof(*di->jes));
+		if (di->jes == NULL) {
+			di->njes = di->jalloc = 0;
+			zfs_close(zhp);
+			return (ENOMEM);
+		}
+	}
+
+	de = &di->jes[di->njes++];
+	du_fill(zhp, de);
+	de->active = strcmp(de->name, di->active) == 0;
+
+	if ((src = du_source(di, zhp)) != NULL) {
+		src->clones++;
+		if (de->shared > src->shared)
+			src->shared = de->shared;
+	}
+
+	if (de->shared > di->jail.shared)
+		di->jail.shared = de->shared;
+
+	if (!de->active) {
+		di->reclaim += de->unique;
+		di->ninactive++;
+	}
+
+	zfs_close(zhp);
+	return (0);
+}
+
+/* a jail, followed by its jail environments */
+static int
+du_jail(struct du_info *di, zfs_handle_t *jds)
+{
+	size_t i;
+	zfs_handle_t *je;
+	const char *name;
+	char buf[ZFS_MAX_DATASET_NAME_LEN];
+
+	if ((je = get_active_je(di->hdl, jds)) == NULL)
+		return (0);
+
+	du_fill(jds, &di->jail);
+	di->active = zfs_get_name(je);
+	di->njes = 0;
+
+	zfs_iter_filesystems(jds, du_je_cb, di);
+
+	du_print(di, zfs_get_name(jds), "jail", &di->jail);
+	for (i = 0; i < di->njes; i++) {
+		name = di->jes[i].name;
+		if ((di->flags & JE_DU_SCRIPTED) == 0) {
+			snprintf(buf, sizeof(buf), "  %s", strrchr(name, '/') + 1);
+			name = buf;
+		}
+		du_print(di, name, di->jes[i].active ? "active" : "je",
+		    &di->jes[i]);
+	}
+
+	zfs_close(je);
+	return (0);
+}
+
+static int
+du_jail_cb(zfs_handle_t *jds, void *arg)
+{
+	du_jail(arg, jds);
+	zfs_close(jds);
+	return (0);
+}
+
+static int
+du_snapshot_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct du_info *di = arg;
+	const char *snap;
+
+	/* left behind by je_copy, nothing was cloned from it */
+	snap = strchr(zfs_get_name(zhp), '@') + 1;
+	di->src_snaps++;
+	if (zfs_prop_get_int(zhp, ZFS_PROP_NUMCLONES) == 0 &&
+	    strncmp(snap, JE_COPY_SNAP, strlen(JE_COPY_SNAP)) == 0 &&
+	    (snap[strlen(JE_COPY_SNAP)] == '\0' ||
+	    snap[strlen(JE_COPY_SNAP)] == '.')) {
+		di->src_unused_used += zfs_prop_get_int(zhp, ZFS_PROP_USED);
+		di->src_unused++;
+	}
+
+	zfs_close(zhp);
+	return (0);
+}
+
+/*
+ * What destroying the unused @jectl snapshots of source zhp frees. The
+ * used of a snapshot only counts blocks no other snapshot has, blocks
+ * held by two of them are in neither. When all of them go, that is
+ * usedbysnapshots exactly; otherwise the sum of used is what is freed
+ * at least.
+ */
+static void
+du_snapshots(struct du_info *di, zfs_handle_t *zhp)
+{
+	di->src_snaps = di->src_unused = di->src_unused_used = 0;
+	zfs_iter_snapshots(zhp, B_FALSE, du_snapshot_cb, di, 0, 0);
+	if (di->src_unused == 0)
+		return;
+
+	if (di->src_unused == di->src_snaps)
+		di->reclaim_snap += zfs_prop_get_int(zhp, ZFS_PROP_USEDSNAP);
+	else
+		di->reclaim_snap += di->src_unused_used;
+	di->nsnap += di->src_unused;
+}
+
+/*
+ * print unique and shared space of every jail environment, every jail
+ * (or only jail, if not NULL) and every source, and what removing
+ * inactive jail environments and unused @jectl snapshots would free.
+ * There is no gc command; this is what one would reclaim.
+ */
+int
+je_du(libjectl_handle_t *hdl, const char *jail, int flags, FILE *fp)
+{
+	int i;
+	size_t j;
+	char reclaim[32];
+	zfs_handle_t *zhp;
+	struct du_entry total;
+	struct du_info di = { 0 };
+
+	di.hdl = hdl;
+	di.fp = fp;
+	di.flags = flags;
+
+	for (i = 0; i < hdl->njepools; i++) {
+		if ((zhp = zfs_open(hdl->lzh, hdl->jepools[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(zhp, du_source_cb, &di);
+		zfs_close(zhp);
+	}
+	qsort(di.sources, di.nsources, sizeof(*di.sources), du_compare);
+
+	if ((flags & JE_DU_SCRIPTED) == 0)
+		fprintf(fp, "%-40s %-7s %8s %8s %8s\n", "NAME", "TYPE", "UNIQUE",
+		    "SHARED", "REFER");
+
+	if (jail != NULL) {
+		if ((zhp = get_jail_dataset(hdl, jail)) == NULL) {
+			free(di.sources);
+			return (hdl->error);
+		}
+		du_jail(&di, zhp);
+		zfs_close(zhp);
+	} else {
+		for (i = 0; i < hdl->njeroots; i++) {
+			if ((zhp = zfs_open(hdl->lzh, hdl->jeroots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			zfs_iter_filesystems(zhp, du_jail_cb, &di);
+			zfs_close(zhp);
+		}
+	}
+
+	for (j = 0; j < di.nsources; j++) {
+		/* only the sources used by the jail asked for */
+		if (jail != NULL && di.sources[j].clones == 0)
+			continue;
+		du_print(&di, di.sources[j].name, "source", &di.sources[j]);
+
+		if ((zhp = zfs_open(hdl->lzh, di.sources[j].name, ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		du_snapshots(&di, zhp);
+		zfs_close(zhp);
+	}
+
+	if ((flags & JE_DU_SCRIPTED) == 0) {
+		zfs_nicenum(di.reclaim + di.reclaim_snap, reclaim, sizeof(reclaim));
+		fprintf(fp, "\nreclaimable: %s (%ju inactive jail environments, "
+		    "%ju unused snapshots)\n", reclaim, (uintmax_t)di.ninactive,
+		    (uintmax_t)di.nsnap);
+	} else {
+		memset(&total, 0, sizeof(total));
+		total.unique = di.reclaim + di.reclaim_snap;
+		du_print(&di, "-", "reclaim", &total);
+	}
+
+	free(di.jes);
+	free(di.sources);
+	return (0);
+}
@@ -0,0 +1,449 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <libzfs_impl.h>
+#include <libgen.h>
+#include <pthread.h>
+
+#include "libjectl_impl.h"
+
+struct dump_info {
+	libjectl_handle_t *hdl;
+	FILE *fp;
+	int count;
+};
+
+static void
+print_je(FILE *fp, zfs_handle_t *je)
+{
+	char *name;
+	char *value;
+	char buffer[ZFS_MAXPROPLEN];
+
+	name = strdup(zfs_get_name(je));
+
+	if (get_property(je, "je:active", &value) == 0 &&
+	    strcmp(value, zfs_get_name(je)) == 0) {
+		snprintf(buffer, sizeof(buffer), "%s (ACTIVE)", basename(name));
+	} else
+		snprintf(buffer, sizeof(buffer), "%s", basename(name));
+
+	fprintf(fp, "  Name:              %s\n", buffer);
+
+	if (get_property(je, "je:version", &value) == 0)
+		fprintf(fp, "    branch:            %s\n", value);
+	if (get_property(je, "je:poudriere:freebsd_version", &value) == 0)
+		fprintf(fp, "    version:           %s\n", value);
+	if (get_property(je, "je:poudriere:jailname", &value) == 0)
+		fprintf(fp, "    poudriere-jail:    %s\n", value);
+	if (get_property(je, "je:poudriere:overlaydir", &value) == 0)
+		fprintf(fp, "    overlay:           %s\n", value);
+	if (get_property(je, "je:poudriere:packagelist", &value) == 0)
+		fprintf(fp, "    packagelist:       %s\n", value);
+
+	free(name);
+	return;
+}
+
+static int
+print_jail_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct dump_info *di = arg;
+
+	if (je_persistent(zhp)) {
+		zfs_close(zhp);
+		return (0);
+	}
+
+	fprintf(di->fp, "%d.", di->count++);
+	print_je(di->fp, zhp);
+	zfs_close(zhp);
+	return (0);
+}
+
+
+static int
+print_jail(zfs_handle_t *jds, void *arg)
+{
+	struct dump_info *di = arg;
+	struct dump_info jdi;
+	zfs_handle_t *je;
+	char *name;
+
+	if ((je = get_active_je(di->hdl, jds)) == NULL)
+		return (0);
+	zfs_close(je);
+
+	name = strdup(zfs_get_name(jds));
+	fprintf(di->fp, "Jail name: %s\n", basename(name));
+	fprintf(di->fp, "Environments:\n");
+	free(name);
+
+	jdi = *di;
+	jdi.count = 1;
+	zfs_iter_filesystems(jds, print_jail_cb, &jdi);
+	fprintf(di->fp, "\n");
+
+	return (0);
+}
+
+static int
+print_all(libjectl_handle_t *hdl, FILE *fp)
+{
+	int i;
+	zfs_handle_t *zhp;
+	struct dump_info di = { hdl, fp, 1 };
+
+	/* print jails */
+	for (i = 0; i < hdl->njeroots; i++) {
+		if ((zhp = zfs_open(hdl->lzh, hdl->jeroots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(zhp, print_jail, &di);
+		zfs_close(zhp);
+	}
+
+	fprintf(fp, "Available jail environments:\n");
+	for (i = 0; i < hdl->njepools; i++) {
+		if ((zhp = zfs_open(hdl->lzh, hdl->jepools[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(zhp, print_jail_cb, &di);
+		zfs_close(zhp);
+	}
+
+	return (0);
+}
+
+/*
+ * JSON output, a stable schema for tooling:
+ *
+ *	{"jails": [
+ *	  {"name": ..., "dataset": ..., "active": <dataset>,
+ *	   "update": <dataset> or null, "environments": [
+ *	    {"name": ..., "dataset": ..., "active": true|false,
+ *	     "properties": {"je:version": ..., ...}}, ...]}, ...],
+ *	"available": [
+ *	  {"name": ..., "dataset": ..., "properties": {...}}, ...]}
+ *
+ * Finding the update candidate of a jail walks the jepools, which is
+ * where the time goes on hosts with many jails. The jails are split
+ * between workers, each with a libzfs handle of its own, and every jail
+ * is written to a buffer of its own so the output keeps its order.
+ */
+#define	DUMP_MAXWORKERS	8
+
+struct dump_work {
+	libjectl_handle_t *hdl;
+	char **jails;		/* jail dataset names */
+	char **out;		/* JSON of each, empty if not a jail */
+	size_t count;
+	size_t alloc;
+};
+
+struct dump_worker {
+	struct dump_work *dw;
+	size_t first;		/* jails first, first + step, ... */
+	size_t step;
+	bool done;
+	pthread_t tid;
+};
+
+struct dump_json_info {
+	FILE *fp;
+	const char *active;	/* of the jail, NULL for the jepools */
+	int count;
+};
+
+/* the je: user properties of zhp, as an object */
+static void
+dump_json_props(FILE *fp, zfs_handle_t *zhp)
+{
+	nvpair_t *nvp;
+	nvlist_t *propval;
+	char *value;
+	bool first;
+
+	first = true;
+	fprintf(fp, "{");
+	for (nvp = nvlist_next_nvpair(zfs_get_user_props(zhp), NULL);
+	    nvp != NULL; nvp = nvlist_next_nvpair(zfs_get_user_props(zhp), nvp)) {
+		if (strncmp(nvpair_name(nvp), "je:", 3) != 0 ||
+		    nvpair_value_nvlist(nvp, &propval) != 0 ||
+		    nvlist_lookup_string(propval, ZPROP_VALUE, &value) != 0 ||
+		    *value == '\0')
+			continue;
+		fprintf(fp, "%s", first ? "" : ", ");
+		je_json_string(fp, nvpair_name(nvp));
+		fprintf(fp, ": ");
+		je_json_string(fp, value);
+		first = false;
+	}
+	fprintf(fp, "}");
+}
+
+static int
+dump_json_je_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct dump_json_info *dj = arg;
+	FILE *fp = dj->fp;
+
+	if (je_persistent(zhp)) {
+		zfs_close(zhp);
+		return (0);
+	}
+
+	fprintf(fp, "%s\n    {\"name\": ", dj->count++ == 0 ? "" : ",");
+	je_json_string(fp, strrchr(zfs_get_name(zhp), '/') + 1);
+	fprintf(fp, ", \"dataset\": ");
+	je_json_string(fp, zfs_get_name(zhp));
+	if (dj->active != NULL)
+		fprintf(fp, ", \"active\": %s",
+		    strcmp(dj->active, zfs_get_name(zhp)) == 0 ?
+		    "true" : "false");
+	fprintf(fp, ", \"properties\": ");
+	dump_json_props(fp, zhp);
+	fprintf(fp, "}");
+
+	zfs_close(zhp);
+	return (0);
+}
+
+static void
+dump_json_jail(libjectl_handle_t *hdl, zfs_handle_t *jds, FILE *fp)
+{
+	char *active;
+	zfs_handle_t *candidate;
+	struct dump_json_info dj;
+
+	/* not a jail dataset, e.g. the warm pool */
+	if (get_property(jds, "je:active", &active) != 0)
+		return;
+
+	fprintf(fp, "  {\"name\": ");
+	je_json_string(fp, strrchr(zfs_get_name(jds), '/') + 1);
+	fprintf(fp, ", \"dataset\": ");
+	je_json_string(fp, zfs_get_name(jds));
+	fprintf(fp, ", \"active\": ");
+	je_json_string(fp, active);
+	fprintf(fp, ", \"update\": ");
+	if ((candidate = je_candidate(hdl, jds)) != NULL) {
+		je_json_string(fp, zfs_get_name(candidate));
+		zfs_close(candidate);
+	} else
+		fprintf(fp, "null");
+	fprintf(fp, ", \"environments\": [");
+
+	dj.fp = fp;
+	dj.active = active;
+	dj.count = 0;
+	zfs_iter_filesystems(jds, dump_json_je_cb, &dj);
+	fprintf(fp, "\n  ]}");
+}
+
+static void
+dump_range(libjectl_handle_t *hdl, struct dump_work *dw, size_t first,
+    size_t step)
+{
+	size_t i, len;
+	FILE *fp;
+	zfs_handle_t *jds;
+
+	for (i = first; i < dw->count; i += step) {
+		if ((jds = zfs_open(hdl->lzh, dw->jails[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		if ((fp = open_memstream(&dw->out[i], &len)) != NULL) {
+			dump_json_jail(hdl, jds, fp);
+			fclose(fp);
+		}
+		zfs_close(jds);
+	}
+}
+
+static void *
+dump_worker(void *arg)
+{
+	struct dump_worker *w = arg;
+	libjectl_handle_t *hdl;
+
+	if ((hdl = je_handle_dup(w->dw->hdl)) == NULL)
+		return (NULL);
+
+	dump_range(hdl, w->dw, w->first, w->step);
+	w->done = true;
+
+	libjectl_close(hdl);
+	return (NULL);
+}
+
+static int
+dump_collect_cb(zfs_handle_t *jds, void *arg)
+{
+	struct dump_work *dw = arg;
+	char *name;
+
+	if (dw->count == dw->alloc) {
+		dw->alloc = dw->alloc == 0 ? 64 : dw->alloc * 2;
+		dw->jails = reallocf(dw->jails, dw->alloc * sizeof(*dw->jails));
+		if (dw->jails == NULL) {
+			dw->count = dw->alloc = 0;
+			zfs_close(jds);
+			return (ENOMEM);
+		}
+	}
+
+	if ((name = strdup(zfs_get_name(jds))) != NULL)
+		dw->jails[dw->count++] = name;
+
+	zfs_close(jds);
+	return (name == NULL ? ENOMEM : 0);
+}
+
+static int
+dump_json(libjectl_handle_t *hdl, const char *jail, FILE *fp)
+{
+	int i, error;
+	size_t j, n, nworkers, len;
+	long ncpu;
+	bool first;
+	FILE *afp;
+	char *avail;
+	zfs_handle_t *zhp;
+	struct dump_work dw;
+	struct dump_worker workers[DUMP_MAXWORKERS];
+	struct dump_json_info dj;
+
+	memset(&dw, 0, sizeof(dw));
+	dw.hdl = hdl;
+
+	error = 0;
+	if (jail != NULL) {
+		if ((zhp = get_jail_dataset(hdl, jail)) == NULL)
+			return (hdl->error);
+		error = dump_collect_cb(zhp, &dw);
+	} else {
+		for (i = 0; i < hdl->njeroots && error == 0; i++) {
+			if ((zhp = zfs_open(hdl->lzh, hdl->jeroots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			error = zfs_iter_filesystems(zhp, dump_collect_cb, &dw);
+			zfs_close(zhp);
+		}
+	}
+	if (error != 0 || (dw.count > 0 &&
+	    (dw.out = calloc(dw.count, sizeof(*dw.out))) == NULL)) {
+		error = je_error(hdl, JE_ERR_NOMEM, "out of memory");
+		goto out;
+	}
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nworkers = ncpu < 1 ? 1 : (size_t)ncpu;
+	if (nworkers > DUMP_MAXWORKERS)
+		nworkers = DUMP_MAXWORKERS;
+	if (nworkers > dw.count)
+		nworkers = dw.count;
+
+	for (n = 0; n < nworkers; n++) {
+		workers[n].dw = &dw;
+		workers[n].first = n;
+		workers[n].step = nworkers;
+		workers[n].done = false;
+		if (pthread_create(&workers[n].tid, NULL, dump_worker,
+		    &workers[n]) != 0)
+			break;
+	}
+
+	/* the jepools meanwhile, to a buffer as well */
+	avail = NULL;
+	if ((afp = open_memstream(&avail, &len)) != NULL) {
+		dj.fp = afp;
+		dj.active = NULL;
+		dj.count = 0;
+		for (i = 0; i < hdl->njepools; i++) {
+			if ((zhp = zfs_open(hdl->lzh, hdl->jepools[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			zfs_iter_filesystems(zhp, dump_json_je_cb, &dj);
+			zfs_close(zhp);
+		}
+		fclose(afp);
+	}
+
+	for (j = 0; j < n; j++)
+		pthread_join(workers[j].tid, NULL);
+	/* no thread, or no handle, for them: do their share here */
+	for (j = 0; j < nworkers; j++) {
+		if (j >= n || !workers[j].done)
+			dump_range(hdl, &dw, j, nworkers);
+	}
+
+	fprintf(fp, "{\"jails\": [");
+	first = true;
+	for (j = 0; j < dw.count; j++) {
+		if (dw.out[j] == NULL || *dw.out[j] == '\0')
+			continue;
+		fprintf(fp, "%s\n%s", first ? "" : ",", dw.out[j]);
+		first = false;
+	}
+	fprintf(fp, "\n],\n\"available\": [%s\n]}\n",
+	    avail != NULL ? avail : "");
+	free(avail);
+
+out:
+	for (j = 0; j < dw.count; j++) {
+		free(dw.jails[j]);
+		if (dw.out != NULL)
+			free(dw.out[j]);
+	}
+	free(dw.jails);
+	free(dw.out);
+
+	return (error);
+}
+
+/*
+ * print the jail environments of jail to fp, every jail and the
+ * available jail environments when jail is NULL. JE_DUMP_JSON prints
+ * them as JSON.
+ */
+int
+je_dump(libjectl_handle_t *hdl, const char *jail, int flags, FILE *fp)
+{
+	zfs_handle_t *jds;
+	struct dump_info di = { hdl, fp, 1 };
+
+	if ((flags & JE_DUMP_JSON) != 0)
+		return (dump_json(hdl, jail, fp));
+
+	if (jail == NULL)
+		return (print_all(hdl, fp));
+
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (hdl->error);
+
+	print_jail(jds, &di);
+
+	zfs_close(jds);
+
+	return (0);
+}
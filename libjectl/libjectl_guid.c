@@ -0,0 +1,175 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Received snapshots keep the guid they had on the sending side, so the
+ * guid of a stream's snapshot identifies it on every host it was imported
+ * to. The map of snapshot guids below every root is built once per handle,
+ * on first use, and kept sorted for lookups.
+ */
+struct guid_entry {
+	uint64_t guid;
+	char *name;
+};
+
+struct je_guidmap {
+	struct guid_entry *entries;
+	size_t count;
+	size_t alloc;
+};
+
+static int
+guid_compare(const void *a, const void *b)
+{
+	const struct guid_entry *ga = a, *gb = b;
+
+	if (ga->guid < gb->guid)
+		return (-1);
+	return (ga->guid > gb->guid);
+}
+
+static int
+guid_add(struct je_guidmap *gm, uint64_t guid, const char *name)
+{
+	struct guid_entry *ge;
+
+	if (gm->count == gm->alloc) {
+		gm->alloc = gm->alloc == 0 ? 64 : gm->alloc * 2;
+		gm->entries = reallocf(gm->entries,
+		    gm->alloc * sizeof(*gm->entries));
+		if (gm->entries == NULL) {
+			gm->count = gm->alloc = 0;
+			return (ENOMEM);
+		}
+	}
+
+	ge = &gm->entries[gm->count];
+	ge->guid = guid;
+	if ((ge->name = strdup(name)) != NULL)
+		gm->count++;
+
+	return (0);
+}
+
+/*
+ * A snapshot standing in for a received one that was replaced, see
+ * je_rebase, is found by the guid of either.
+ */
+static int
+guid_snapshot_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct je_guidmap *gm = arg;
+	int error;
+	char *recorded;
+
+	error = guid_add(gm, zfs_prop_get_int(zhp, ZFS_PROP_GUID),
+	    zfs_get_name(zhp));
+	if (error == 0 && get_property(zhp, JE_GUID_PROP, &recorded) == 0)
+		error = guid_add(gm, strtoull(recorded, NULL, 10),
+		    zfs_get_name(zhp));
+
+	zfs_close(zhp);
+	return (error);
+}
+
+static int
+guid_filesystem_cb(zfs_handle_t *zhp, void *arg)
+{
+	int error;
+
+	error = zfs_iter_snapshots(zhp, B_FALSE, guid_snapshot_cb, arg, 0, 0);
+	if (error == 0)
+		error = zfs_iter_filesystems(zhp, guid_filesystem_cb, arg);
+
+	zfs_close(zhp);
+	return (error);
+}
+
+static void
+guid_load_roots(libjectl_handle_t *hdl, je_root_t type)
+{
+	int i, count;
+	const char * const *roots;
+	zfs_handle_t *zhp;
+
+	count = libjectl_get_roots(hdl, type, &roots);
+	for (i = 0; i < count; i++) {
+		if ((zhp = zfs_open(hdl->lzh, roots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(zhp, guid_filesystem_cb, hdl->guidmap);
+		zfs_close(zhp);
+	}
+}
+
+/*
+ * return the name of the snapshot with the given guid, NULL if there
+ * is no such snapshot below any root.
+ */
+const char *
+je_guid_lookup(libjectl_handle_t *hdl, uint64_t guid)
+{
+	struct je_guidmap *gm;
+	struct guid_entry key, *ge;
+
+	if (guid == 0)
+		return (NULL);
+
+	if ((gm = hdl->guidmap) == NULL) {
+		if ((gm = hdl->guidmap = calloc(1, sizeof(*gm))) == NULL)
+			return (NULL);
+		guid_load_roots(hdl, JE_ROOT_JEPOOL);
+		guid_load_roots(hdl, JE_ROOT_JEROOT);
+		qsort(gm->entries, gm->count, sizeof(*gm->entries),
+		    guid_compare);
+	}
+
+	key.guid = guid;
+	ge = bsearch(&key, gm->entries, gm->count, sizeof(*gm->entries),
+	    guid_compare);
+
+	return (ge != NULL ? ge->name : NULL);
+}
+
+void
+je_guidmap_free(libjectl_handle_t *hdl)
+{
+	size_t i;
+	struct je_guidmap *gm;
+
+	if ((gm = hdl->guidmap) == NULL)
+		return;
+
+	for (i = 0; i < gm->count; i++)
+		free(gm->entries[i].name);
+	free(gm->entries);
+	free(gm);
+	hdl->guidmap = NULL;
+}
@@ -0,0 +1,152 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LIBJECTL_IMPL_H
+#define _LIBJECTL_IMPL_H
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+
+#include "libjectl.h"
+
+#define	JE_ERRBUF_SIZE	1024
+
+/* how to pick a root for newly created datasets */
+enum je_placement {
+	JE_PLACE_FIRST,		/* always the first root listed */
+	JE_PLACE_SPREAD,	/* the root with the most available space */
+};
+
+struct je_guidmap;
+struct je_mnttab;
+
+struct libjectl_handle {
+	libzfs_handle_t *lzh;
+	/*
+	 * Jail datasets and jail environments are searched for in every
+	 * root, new ones are placed according to placement.
+	 */
+	const char *jepools[JE_MAXROOTS];
+	const char *jeroots[JE_MAXROOTS];
+	int njepools;
+	int njeroots;
+	char *jepools_buf;	/* storage for the jepools names */
+	char *jeroots_buf;
+	enum je_placement placement;
+	je_error_t error;
+	char errbuf[JE_ERRBUF_SIZE];
+	bool print_on_error;
+	bool verbose;
+	struct je_guidmap *guidmap;	/* built on first use */
+	struct je_mnttab *mnttab;	/* built on first use */
+};
+
+int je_error(libjectl_handle_t *, je_error_t, const char *, ...)
+    __printflike(3, 4);
+void je_warn(libjectl_handle_t *, const char *, ...) __printflike(2, 3);
+void je_info(libjectl_handle_t *, const char *, ...) __printflike(2, 3);
+libjectl_handle_t * je_handle_dup(libjectl_handle_t *);
+
+const char * je_place(libjectl_handle_t *, je_root_t);
+bool je_exists(libjectl_handle_t *, je_root_t, const char *);
+bool je_same_pool(const char *, const char *);
+
+/* a zfs send stream, read by je_stream_open */
+struct je_stream {
+	int fd;
+	off_t size;		/* stream size if known, -1 otherwise */
+	char *header;		/* bytes consumed while parsing the header */
+	size_t hdrlen;
+	nvlist_t *payload;	/* replication stream payload */
+	nvlist_t *props;	/* properties of the top-level dataset */
+	char toname[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t toguid;
+	uint64_t fromguid;
+	bool clone;		/* sent from the origin of a clone */
+	uint64_t bytes;		/* bytes handed to zfs_receive */
+	uint64_t rate;		/* throttle, bytes per second */
+	uint64_t latency;	/* adaptive throttle, target latency in ns */
+};
+
+int je_stream_open(libjectl_handle_t *, struct je_stream *, int);
+void je_stream_close(struct je_stream *);
+int je_stream_prop(struct je_stream *, const char *, char **);
+bool je_stream_fits(libjectl_handle_t *, struct je_stream *, const char *);
+int je_stream_receive(libjectl_handle_t *, struct je_stream *, const char *,
+    nvlist_t *);
+
+int get_property(zfs_handle_t *, const char *, char **);
+nvlist_t * je_user_props(zfs_handle_t *);
+bool je_persistent(zfs_handle_t *);
+void je_json_string(FILE *, const char *);
+
+int je_copy_tree(libjectl_handle_t *, const char *, const char *);
+
+int je_profile_props(libjectl_handle_t *, const char *, nvlist_t *);
+int je_profile_of(libjectl_handle_t *, zfs_handle_t *, nvlist_t *);
+void je_profile_descendants(libjectl_handle_t *, zfs_handle_t *);
+
+/* on a snapshot, the guid of the received snapshot it stands in for */
+#define	JE_GUID_PROP	"je:guid"
+
+const char * je_guid_lookup(libjectl_handle_t *, uint64_t);
+void je_guidmap_free(libjectl_handle_t *);
+
+bool je_is_mounted(libjectl_handle_t *, zfs_handle_t *, char **);
+const char * je_mnttab_dataset(libjectl_handle_t *, const char *);
+void je_mnttab_add(libjectl_handle_t *, const char *, const char *);
+void je_mnttab_remove(libjectl_handle_t *, const char *);
+void je_mnttab_flush(libjectl_handle_t *);
+
+uint64_t je_now_ns(void);
+void je_metrics_sample(const char *, const char *, const char *, uint64_t,
+    uint64_t);
+
+zfs_handle_t * get_jail_dataset(libjectl_handle_t *, const char *);
+zfs_handle_t * get_active_je(libjectl_handle_t *, zfs_handle_t *);
+
+/* snapshots je_copy_impl clones from, jectl.<UTC time>.<ns>.<pid> */
+#define	JE_COPY_SNAP	"jectl"
+
+zfs_handle_t * je_copy(libjectl_handle_t *, zfs_handle_t *, zfs_handle_t *);
+zfs_handle_t * je_copy_impl(libjectl_handle_t *, zfs_handle_t *, const char *);
+
+int je_rebase(libjectl_handle_t *, const char *);
+
+int je_activate_impl(libjectl_handle_t *, zfs_handle_t *, const char *);
+int je_destroy(zfs_handle_t *);
+int je_mount_impl(libjectl_handle_t *, zfs_handle_t *, const char *);
+void je_gather(zfs_handle_t *, get_all_cb_t *);
+void je_gather_free(get_all_cb_t *);
+void je_gather_persistent(zfs_handle_t *, get_all_cb_t *);
+int je_swapin(libjectl_handle_t *, zfs_handle_t *, zfs_handle_t *);
+int je_unmount_impl(libjectl_handle_t *, zfs_handle_t *, int);
+int je_unmount_persistent(libjectl_handle_t *, zfs_handle_t *, int);
+zfs_handle_t * je_candidate(libjectl_handle_t *, zfs_handle_t *);
+
+#endif /* _LIBJECTL_IMPL_H */
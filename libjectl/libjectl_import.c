@@ -0,0 +1,305 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/* is dataset $root/name for one of the given roots */
+static bool
+in_roots(libjectl_handle_t *hdl, je_root_t type, const char *dataset,
+    const char *name)
+{
+	int i, count;
+	const char * const *roots;
+	char buf[ZFS_MAX_DATASET_NAME_LEN];
+
+	count = libjectl_get_roots(hdl, type, &roots);
+	for (i = 0; i < count; i++) {
+		snprintf(buf, sizeof(buf), "%s/%s", roots[i], name);
+		if (strcmp(buf, dataset) == 0)
+			return (true);
+	}
+
+	return (false);
+}
+
+/* the first jepool in the pool dataset name lives in, NULL if none */
+static const char *
+jepool_of(libjectl_handle_t *hdl, const char *name)
+{
+	int i;
+	char pool[ZFS_MAX_DATASET_NAME_LEN];
+
+	for (i = 0; i < hdl->njepools; i++) {
+		strlcpy(pool, hdl->jepools[i], sizeof(pool));
+		pool[strcspn(pool, "/")] = '\0';
+		if (je_same_pool(pool, name))
+			return (hdl->jepools[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * The stream has been imported before, its snapshot is still around.
+ * Importing it again under the same name is a no-op. A jail environment
+ * imported under another name becomes a clone of the existing one, no
+ * data is written. Returns -1 when the stream has to be received after
+ * all: a new jail from the same stream is a jail of its own, and a
+ * snapshot in a pool without a jepool cannot be cloned.
+ */
+static int
+import_duplicate(libjectl_handle_t *hdl, const char *snapshot, bool create,
+    const char *import_name)
+{
+	int error;
+	nvlist_t *props;
+	zfs_handle_t *zhp, *snap;
+	const char *root;
+	char dataset[ZFS_MAX_DATASET_NAME_LEN];
+	char dest[ZFS_MAX_DATASET_NAME_LEN];
+
+	strlcpy(dataset, snapshot, sizeof(dataset));
+	*strchr(dataset, '@') = '\0';
+
+	if (in_roots(hdl, create ? JE_ROOT_JEROOT : JE_ROOT_JEPOOL, dataset,
+	    import_name)) {
+		je_info(hdl, "'%s' already imported as '%s'", import_name, dataset);
+		return (0);
+	}
+
+	if (create)
+		return (-1);
+
+	if ((root = jepool_of(hdl, snapshot)) == NULL)
+		return (-1);
+
+	if ((zhp = zfs_open(hdl->lzh, dataset, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return (-1);
+	if ((snap = zfs_open(hdl->lzh, snapshot, ZFS_TYPE_SNAPSHOT)) == NULL) {
+		zfs_close(zhp);
+		return (-1);
+	}
+
+	snprintf(dest, sizeof(dest), "%s/%s", root, import_name);
+
+	if ((props = je_user_props(zhp)) == NULL) {
+		zfs_close(snap);
+		zfs_close(zhp);
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+	}
+	nvlist_add_string(props, "canmount", "noauto");
+	nvlist_add_string(props, "mountpoint", "none");
+
+	if ((error = je_profile_of(hdl, zhp, props)) != 0)
+		;
+	else if ((error = zfs_clone(snap, dest, props)) == 0)
+		je_info(hdl, "'%s' already imported as '%s', cloned",
+		    import_name, dataset);
+	else
+		error = je_error(hdl, JE_ERR_ZFSCLONE, "cannot clone '%s'",
+		    snapshot);
+
+	nvlist_free(props);
+	zfs_close(snap);
+	zfs_close(zhp);
+	return (error);
+}
+
+/*
+ * is origin the snapshot with the guid itself, zfs receive does not take
+ * a rebased snapshot that only records it.
+ */
+static bool
+import_origin(libjectl_handle_t *hdl, const char *origin, uint64_t guid)
+{
+	bool same;
+	zfs_handle_t *zhp;
+
+	if ((zhp = zfs_open(hdl->lzh, origin, ZFS_TYPE_SNAPSHOT)) == NULL)
+		return (false);
+	same = zfs_prop_get_int(zhp, ZFS_PROP_GUID) == guid;
+	zfs_close(zhp);
+
+	return (same);
+}
+
+/*
+ * Read the stream header to find out where the stream goes, then receive
+ * it straight into its final name. If je:poudriere:create is set on the
+ * top-level dataset of the stream, it is received as $jeroot/$import_name;
+ * this is how a jail is created. Otherwise, it is received as
+ * $jepool/$import_name so that it can be consumed as a jail environment.
+ *
+ * The stream is read from fd, rate (bytes per second) and latency
+ * (nanoseconds) throttle it, zero for no throttling.
+ *
+ * The profile named by je:profile in the stream, "base" for a jail
+ * environment without one, is applied with receive overrides.
+ *
+ * An incremental jail environment stream, such as the variants
+ * generate-je.sh sends relative to the world they share, is received as
+ * a clone of the snapshot it was sent from, found by its guid.
+ *
+ * With JE_IMPORT_REBASE a jail environment is rebased onto the closest
+ * one in the jepools once received, see je_rebase.
+ */
+int
+je_import(libjectl_handle_t *hdl, int fd, const char *import_name, int flags,
+    uint64_t rate, uint64_t latency)
+{
+	int error;
+	nvlist_t *props;
+	zfs_handle_t *zhp;
+	struct je_stream js;
+	char name[ZFS_MAXPROPLEN];
+	char *default_je, *profile;
+	bool create;
+	je_root_t type;
+	const char *root, *snapshot, *origin;
+	uint64_t start;
+
+	if ((error = je_stream_open(hdl, &js, fd)) != 0) {
+		je_stream_close(&js);
+		return (error);
+	}
+
+	js.rate = rate;
+	js.latency = latency;
+
+	create = je_stream_prop(&js, "je:poudriere:create", &default_je) == 0;
+
+	/* the same stream has been imported before */
+	if ((snapshot = je_guid_lookup(hdl, js.toguid)) != NULL &&
+	    (error = import_duplicate(hdl, snapshot, create, import_name)) >= 0) {
+		je_stream_close(&js);
+		return (error);
+	}
+
+	type = create ? JE_ROOT_JEROOT : JE_ROOT_JEPOOL;
+
+	if (je_exists(hdl, type, import_name)) {
+		je_stream_close(&js);
+		return (je_error(hdl, JE_ERR_EXISTS,
+		    "cannot import '%s': jail dataset already exists", import_name));
+	}
+
+	origin = NULL;
+	if (create || js.fromguid == 0) {
+		root = je_place(hdl, type);
+	} else if ((origin = je_guid_lookup(hdl, js.fromguid)) == NULL) {
+		je_stream_close(&js);
+		return (je_error(hdl, JE_ERR_STREAM,
+		    "cannot import '%s': incremental stream, import the jail "
+		    "environment it was %s from first", import_name,
+		    js.clone ? "cloned" : "sent"));
+	} else if (!import_origin(hdl, origin, js.fromguid)) {
+		je_stream_close(&js);
+		return (je_error(hdl, JE_ERR_STREAM,
+		    "cannot import '%s': '%s' was rebased, it only stands in "
+		    "for the snapshot the stream was sent from", import_name,
+		    origin));
+	} else {
+		/* a clone lives in the pool of its origin */
+		if ((root = jepool_of(hdl, origin)) == NULL) {
+			je_stream_close(&js);
+			return (je_error(hdl, JE_ERR_STREAM,
+			    "cannot import '%s': no jepool in the pool of '%s'",
+			    import_name, origin));
+		}
+	}
+
+	if (!je_stream_fits(hdl, &js, root)) {
+		je_stream_close(&js);
+		return (je_error(hdl, JE_ERR_NOSPACE,
+		    "cannot import '%s': not enough space in '%s'",
+		    import_name, root));
+	}
+
+	snprintf(name, sizeof(name), "%s/%s", root, import_name);
+
+	if (nvlist_alloc(&props, NV_UNIQUE_NAME, 0) != 0) {
+		je_stream_close(&js);
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+	}
+
+	if (create) {
+		nvlist_add_string(props, "canmount", "off");
+		nvlist_add_string(props, "mountpoint", "none");
+		/* exclude, it has served its purpose */
+		nvlist_add_boolean(props, "je:poudriere:create");
+	} else {
+		nvlist_add_string(props, "canmount", "noauto");
+		nvlist_add_string(props, "mountpoint", "none");
+		if (origin != NULL)
+			nvlist_add_string(props, "origin", origin);
+	}
+
+	if (je_stream_prop(&js, "je:profile", &profile) != 0)
+		profile = create ? NULL : "base";
+	if (profile != NULL &&
+	    (error = je_profile_props(hdl, profile, props)) != 0) {
+		nvlist_free(props);
+		je_stream_close(&js);
+		return (error);
+	}
+
+	start = je_now_ns();
+	error = je_stream_receive(hdl, &js, name, props);
+
+	nvlist_free(props);
+
+	if (error != 0) {
+		je_stream_close(&js);
+		return (error);
+	}
+
+	je_metrics_sample(import_name, "import", "receive", je_now_ns() - start,
+	    js.bytes);
+
+	if ((zhp = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL) {
+		je_stream_close(&js);
+		return (je_error(hdl, JE_ERR_ZFSOPEN,
+		    "cannot open imported dataset '%s'", name));
+	}
+
+	je_profile_descendants(hdl, zhp);
+
+	if (create)
+		error = je_activate_impl(hdl, zhp, default_je);
+	zfs_close(zhp);
+
+	/* a clone shares what it can already */
+	if (error == 0 && !create && origin == NULL &&
+	    (flags & JE_IMPORT_REBASE) != 0)
+		error = je_rebase(hdl, name);
+
+	je_stream_close(&js);
+
+	return (error);
+}
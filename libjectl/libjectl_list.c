@@ -0,0 +1,393 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <ctype.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * List jails and jail environments in a single walk of the roots: the
+ * jail environments in the jepools, the jails in the jeroots and their
+ * jail environments. Descendants of jail environments, persistent
+ * datasets and the warm pool are left out. libzfs fetches the properties
+ * of each dataset with the one ioctl that iterates it, only the columns
+ * asked for are formatted.
+ *
+ * A column is any native property, any user property (je:version...) or
+ * one of:
+ *	name	the dataset
+ *	type	source (a jail environment in a jepool), jail or je
+ *	active	yes for the active jail environment of a jail
+ */
+#define	LIST_DEFAULT	"name,type,active,used,refer,je:version"
+#define	LIST_MAXCOLS	32
+
+struct list_row {
+	char *name;
+	char **values;		/* one per column */
+	char *sortval;		/* exact value of the sort column */
+};
+
+struct list_info {
+	int flags;
+	const char *cols[LIST_MAXCOLS];
+	int ncols;
+	const char *sort;
+	struct list_row *rows;
+	size_t count;
+	size_t alloc;
+	const char *type;	/* of the datasets being walked */
+	const char *active;	/* of the jail being walked */
+	int error;
+};
+
+static bool
+list_column(const char *col)
+{
+	return (strcmp(col, "name") == 0 || strcmp(col, "type") == 0 ||
+	    strcmp(col, "active") == 0 || strchr(col, ':') != NULL ||
+	    zfs_name_to_prop(col) != ZPROP_INVAL);
+}
+
+static void
+list_value(struct list_info *li, zfs_handle_t *zhp, const char *col,
+    bool literal, char *buf, size_t len)
+{
+	int prop;
+	char *value;
+
+	if (strcmp(col, "name") == 0)
+		strlcpy(buf, zfs_get_name(zhp), len);
+	else if (strcmp(col, "type") == 0)
+		strlcpy(buf, li->type, len);
+	else if (strcmp(col, "active") == 0)
+		strlcpy(buf, li->active == NULL ? "-" :
+		    strcmp(li->active, zfs_get_name(zhp)) == 0 ? "yes" : "no",
+		    len);
+	else if (strchr(col, ':') != NULL)
+		strlcpy(buf, get_property(zhp, col, &value) == 0 ? value : "-",
+		    len);
+	else if ((prop = zfs_name_to_prop(col)) == ZPROP_INVAL ||
+	    zfs_prop_get(zhp, prop, buf, len, NULL, NULL, 0, literal) != 0)
+		strlcpy(buf, "-", len);
+}
+
+static int
+list_add(struct list_info *li, zfs_handle_t *zhp)
+{
+	int i;
+	struct list_row *row;
+	char buf[ZFS_MAXPROPLEN];
+
+	if (li->count == li->alloc) {
+		li->alloc = li->alloc == 0 ? 64 : li->alloc * 2;
+		li->rows = reallocf(li->rows, li->alloc * sizeof(*li->rows));
+		if (li->rows == NULL) {
+			li->count = li->alloc = 0;
+			return (li->error = ENOMEM);
+		}
+	}
+
+	/* counted right away, so a partial row is freed with the rest */
+	row = &li->rows[li->count++];
+	memset(row, 0, sizeof(*row));
+	if ((row->name = strdup(zfs_get_name(zhp))) == NULL ||
+	    (row->values = calloc(li->ncols, sizeof(*row->values))) == NULL)
+		return (li->error = ENOMEM);
+
+	for (i = 0; i < li->ncols; i++) {
+		list_value(li, zhp, li->cols[i],
+		    (li->flags & JE_LIST_PARSABLE) != 0, buf, sizeof(buf));
+		if ((row->values[i] = strdup(buf)) == NULL)
+			return (li->error = ENOMEM);
+	}
+
+	list_value(li, zhp, li->sort, true, buf, sizeof(buf));
+	if ((row->sortval = strdup(buf)) == NULL)
+		return (li->error = ENOMEM);
+
+	return (0);
+}
+
+static int
+list_source_cb(zfs_handle_t *zhp, void *arg)
+{
+	int error;
+
+	error = list_add(arg, zhp);
+	zfs_close(zhp);
+	return (error);
+}
+
+static int
+list_je_cb(zfs_handle_t *zhp, void *arg)
+{
+	int error;
+
+	error = je_persistent(zhp) ? 0 : list_add(arg, zhp);
+	zfs_close(zhp);
+	return (error);
+}
+
+/* a jail, followed by its jail environments */
+static int
+list_jail(struct list_info *li, zfs_handle_t *jds)
+{
+	char *active;
+
+	/* not a jail dataset, e.g. the warm pool */
+	if (get_property(jds, "je:active", &active) != 0)
+		return (0);
+
+	li->type = "jail";
+	li->active = NULL;
+	if (list_add(li, jds) != 0)
+		return (li->error);
+
+	li->type = "je";
+	li->active = active;
+	zfs_iter_filesystems(jds, list_je_cb, li);
+	li->active = NULL;
+
+	return (li->error);
+}
+
+static int
+list_jail_cb(zfs_handle_t *jds, void *arg)
+{
+	int error;
+
+	error = list_jail(arg, jds);
+	zfs_close(jds);
+	return (error);
+}
+
+static bool
+list_number(const char *s, uint64_t *n)
+{
+	char *end;
+
+	if (!isdigit((unsigned char)*s))
+		return (false);
+	*n = strtoull(s, &end, 10);
+
+	return (*end == '\0');
+}
+
+/* numbers as numbers, ties by name */
+static int
+list_compare(const void *a, const void *b)
+{
+	const struct list_row *ra = a, *rb = b;
+	uint64_t na, nb;
+	int cmp;
+
+	if (list_number(ra->sortval, &na) && list_number(rb->sortval, &nb))
+		cmp = na < nb ? -1 : na > nb;
+	else
+		cmp = strcmp(ra->sortval, rb->sortval);
+
+	return (cmp != 0 ? cmp : strcmp(ra->name, rb->name));
+}
+
+static void
+list_json(struct list_info *li, FILE *fp)
+{
+	size_t i;
+	int c;
+
+	fprintf(fp, "{\"datasets\": [");
+	for (i = 0; i < li->count; i++) {
+		fprintf(fp, "%s\n  {", i == 0 ? "" : ",");
+		for (c = 0; c < li->ncols; c++) {
+			if (c > 0)
+				fprintf(fp, ", ");
+			je_json_string(fp, li->cols[c]);
+			fprintf(fp, ": ");
+			je_json_string(fp, li->rows[i].values[c]);
+		}
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "\n]}\n");
+}
+
+static void
+list_print(struct list_info *li, FILE *fp)
+{
+	size_t i, j;
+	int c, prop, width[LIST_MAXCOLS];
+	bool right[LIST_MAXCOLS];
+	const char *value;
+	char header[ZFS_MAXPROPLEN];
+
+	if ((li->flags & JE_LIST_SCRIPTED) != 0) {
+		for (i = 0; i < li->count; i++) {
+			for (c = 0; c < li->ncols; c++)
+				fprintf(fp, "%s%s", c > 0 ? "\t" : "",
+				    li->rows[i].values[c]);
+			fprintf(fp, "\n");
+		}
+		return;
+	}
+
+	for (c = 0; c < li->ncols; c++) {
+		prop = strchr(li->cols[c], ':') == NULL ?
+		    zfs_name_to_prop(li->cols[c]) : ZPROP_INVAL;
+		right[c] = prop != ZPROP_INVAL && zfs_prop_align_right(prop);
+		width[c] = strlen(li->cols[c]);
+		for (i = 0; i < li->count; i++) {
+			if ((int)strlen(li->rows[i].values[c]) > width[c])
+				width[c] = strlen(li->rows[i].values[c]);
+		}
+	}
+
+	/* user properties keep their case, as with zfs list */
+	for (c = 0; c < li->ncols; c++) {
+		strlcpy(header, li->cols[c], sizeof(header));
+		if (strchr(header, ':') == NULL) {
+			for (j = 0; header[j] != '\0'; j++)
+				header[j] = toupper((unsigned char)header[j]);
+		}
+		fprintf(fp, "%s%*s", c > 0 ? "  " : "",
+		    c == li->ncols - 1 && !right[c] ? 0 :
+		    right[c] ? width[c] : -width[c], header);
+	}
+	fprintf(fp, "\n");
+
+	for (i = 0; i < li->count; i++) {
+		for (c = 0; c < li->ncols; c++) {
+			value = li->rows[i].values[c];
+			fprintf(fp, "%s%*s", c > 0 ? "  " : "",
+			    c == li->ncols - 1 && !right[c] ? 0 :
+			    right[c] ? width[c] : -width[c], value);
+		}
+		fprintf(fp, "\n");
+	}
+}
+
+/*
+ * List jail (all jails and the jail environments in the jepools when
+ * NULL) and its jail environments to fp, with the comma separated
+ * columns, by default LIST_DEFAULT, sorted by column sort, by default
+ * name.
+ */
+int
+je_list(libjectl_handle_t *hdl, const char *jail, const char *columns,
+    const char *sort, int flags, FILE *fp)
+{
+	int i, error;
+	size_t j;
+	char *buf, *p, *col;
+	struct list_row tmp;
+	struct list_info li;
+	zfs_handle_t *zhp;
+
+	memset(&li, 0, sizeof(li));
+	li.flags = flags;
+	li.sort = sort != NULL ? sort : "name";
+
+	if ((buf = strdup(columns != NULL ? columns : LIST_DEFAULT)) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	error = 0;
+	for (p = buf; error == 0 && (col = strsep(&p, ",")) != NULL;) {
+		if (*col == '\0')
+			continue;
+		if (li.ncols == LIST_MAXCOLS)
+			error = je_error(hdl, JE_ERR_INVALIDARG,
+			    "too many columns");
+		else if (!list_column(col))
+			error = je_error(hdl, JE_ERR_INVALIDARG,
+			    "invalid column '%s'", col);
+		else
+			li.cols[li.ncols++] = col;
+	}
+	if (error == 0 && li.ncols == 0)
+		error = je_error(hdl, JE_ERR_INVALIDARG, "no columns given");
+	if (error == 0 && !list_column(li.sort))
+		error = je_error(hdl, JE_ERR_INVALIDARG,
+		    "invalid sort column '%s'", li.sort);
+	if (error != 0) {
+		free(buf);
+		return (error);
+	}
+
+	if (jail != NULL) {
+		if ((zhp = get_jail_dataset(hdl, jail)) == NULL) {
+			free(buf);
+			return (hdl->error);
+		}
+		list_jail(&li, zhp);
+		zfs_close(zhp);
+	} else {
+		li.type = "source";
+		for (i = 0; i < hdl->njepools && li.error == 0; i++) {
+			if ((zhp = zfs_open(hdl->lzh, hdl->jepools[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			zfs_iter_filesystems(zhp, list_source_cb, &li);
+			zfs_close(zhp);
+		}
+		for (i = 0; i < hdl->njeroots && li.error == 0; i++) {
+			if ((zhp = zfs_open(hdl->lzh, hdl->jeroots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			zfs_iter_filesystems(zhp, list_jail_cb, &li);
+			zfs_close(zhp);
+		}
+	}
+
+	if (li.error != 0) {
+		error = je_error(hdl, JE_ERR_NOMEM, "out of memory");
+	} else {
+		qsort(li.rows, li.count, sizeof(*li.rows), list_compare);
+		if ((flags & JE_LIST_REVERSE) != 0) {
+			for (j = 0; j < li.count / 2; j++) {
+				tmp = li.rows[j];
+				li.rows[j] = li.rows[li.count - 1 - j];
+				li.rows[li.count - 1 - j] = tmp;
+			}
+		}
+		if ((flags & JE_LIST_JSON) != 0)
+			list_json(&li, fp);
+		else
+			list_print(&li, fp);
+	}
+
+	for (j = 0; j < li.count; j++) {
+		if (li.rows[j].values != NULL) {
+			for (i = 0; i < li.ncols; i++)
+				free(li.rows[j].values[i]);
+		}
+		free(li.rows[j].values);
+		free(li.rows[j].name);
+		free(li.rows[j].sortval);
+	}
+	free(li.rows);
+	free(buf);
+
+	return (error);
+}
@@ -0,0 +1,536 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Mutating commands append one line per timed phase to the sample log:
+ *
+ *	<unix time> <name> <operation> <phase> <nanoseconds> <bytes>
+ *
+ * `jectl metrics` aggregates the log into histograms and adds the state
+ * of every jail and jail environment, in the OpenMetrics text format.
+ * Appending is a single write(2) to an O_APPEND descriptor, no property
+ * is written, the samples cost no txg sync.
+ *
+ * Once the log passes METRICS_MAXLOG bytes, the sample that crossed it
+ * moves it to <log>.0, replacing the one before. The exporter reads both,
+ * so its work stays bounded however long the host runs. Rotation resets
+ * the counters, which Prometheus handles like a restart.
+ */
+#define	METRICS_LOG		"/var/db/jectl/metrics"
+#define	METRICS_MAXLOG		(1024 * 1024)
+#define	METRICS_MAXHISTS	32
+
+static const double buckets[] = {
+	0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300
+};
+
+struct histogram {
+	char op[16];
+	char phase[16];
+	uint64_t counts[nitems(buckets)];
+	uint64_t count;
+	double sum;
+};
+
+struct jail_metrics {
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	int njes;
+	uint64_t active_created;
+	uint64_t candidate_created;
+	uint64_t last_swap;
+};
+
+struct je_metrics {
+	char dataset[ZFS_MAX_DATASET_NAME_LEN];
+	const char *jail;	/* NULL for the jepools */
+	uint64_t used;
+	uint64_t referenced;
+	uint64_t created;
+	bool active;
+};
+
+struct metrics {
+	libjectl_handle_t *hdl;
+	struct jail_metrics *jails;
+	size_t njails;
+	struct je_metrics *jes;
+	size_t njes;
+	size_t alloc;
+	struct histogram hists[METRICS_MAXHISTS];
+	size_t nhists;
+	uint64_t import_bytes;
+	double import_seconds;
+	double import_last_rate;
+};
+
+static const char *
+metrics_log(void)
+{
+	const char *path;
+
+	if ((path = getenv("JECTL_METRICS")) == NULL)
+		path = METRICS_LOG;
+
+	return (path);
+}
+
+uint64_t
+je_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * Move the log at path, open as fd, aside when it has grown too large.
+ * Only if path is still the file written to, another process may have
+ * moved it already.
+ */
+static void
+metrics_rotate(int fd, const char *path)
+{
+	struct stat fsb, sb;
+	char old[MAXPATHLEN];
+
+	if (fstat(fd, &fsb) != 0 || fsb.st_size < METRICS_MAXLOG)
+		return;
+	if (stat(path, &sb) != 0 || sb.st_dev != fsb.st_dev ||
+	    sb.st_ino != fsb.st_ino)
+		return;
+
+	snprintf(old, sizeof(old), "%s.0", path);
+	rename(path, old);
+}
+
+/*
+ * append a timing sample for name, the last component of a dataset name
+ * or a plain name. Failing to record is not an error of the operation.
+ */
+void
+je_metrics_sample(const char *name, const char *op, const char *phase,
+    uint64_t ns, uint64_t bytes)
+{
+	int fd, len;
+	char line[ZFS_MAX_DATASET_NAME_LEN + 128];
+	char dir[MAXPATHLEN];
+	const char *p, *path;
+
+	if ((p = strrchr(name, '/')) != NULL)
+		name = p + 1;
+
+	len = snprintf(line, sizeof(line), "%jd %s %s %s %ju %ju\n",
+	    (intmax_t)time(NULL), name, op, phase, (uintmax_t)ns,
+	    (uintmax_t)bytes);
+	if (len < 0 || (size_t)len >= sizeof(line))
+		return;
+
+	path = metrics_log();
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 && errno == ENOENT) {
+		/* first sample on this host */
+		strlcpy(dir, path, sizeof(dir));
+		mkdir(dirname(dir), 0755);
+		fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	}
+	if (fd < 0)
+		return;
+	write(fd, line, len);
+	metrics_rotate(fd, path);
+	close(fd);
+}
+
+static struct jail_metrics *
+find_jail(struct metrics *m, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < m->njails; i++) {
+		if (strcmp(m->jails[i].name, name) == 0)
+			return (&m->jails[i]);
+	}
+
+	return (NULL);
+}
+
+static struct histogram *
+find_histogram(struct metrics *m, const char *op, const char *phase)
+{
+	size_t i;
+	struct histogram *h;
+
+	for (i = 0; i < m->nhists; i++) {
+		h = &m->hists[i];
+		if (strcmp(h->op, op) == 0 && strcmp(h->phase, phase) == 0)
+			return (h);
+	}
+
+	if (m->nhists == METRICS_MAXHISTS)
+		return (NULL);
+
+	h = &m->hists[m->nhists++];
+	strlcpy(h->op, op, sizeof(h->op));
+	strlcpy(h->phase, phase, sizeof(h->phase));
+	return (h);
+}
+
+static void
+load_samples(struct metrics *m, const char *path)
+{
+	FILE *fp;
+	size_t i;
+	intmax_t when;
+	uintmax_t ns, bytes;
+	double seconds;
+	struct histogram *h;
+	struct jail_metrics *jm;
+	char line[ZFS_MAX_DATASET_NAME_LEN + 128];
+	char name[ZFS_MAX_DATASET_NAME_LEN], op[16], phase[16];
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%jd %255s %15s %15s %ju %ju", &when, name, op,
+		    phase, &ns, &bytes) != 6)
+			continue;
+
+		seconds = ns / 1e9;
+
+		if ((h = find_histogram(m, op, phase)) != NULL) {
+			for (i = 0; i < nitems(buckets); i++) {
+				if (seconds <= buckets[i])
+					h->counts[i]++;
+			}
+			h->count++;
+			h->sum += seconds;
+		}
+
+		/* the property write is the last phase of every swap */
+		if (strcmp(op, "swap") == 0 && strcmp(phase, "propset") == 0 &&
+		    (jm = find_jail(m, name)) != NULL && (uint64_t)when > jm->last_swap)
+			jm->last_swap = when;
+
+		if (strcmp(op, "import") == 0) {
+			m->import_bytes += bytes;
+			m->import_seconds += seconds;
+			if (seconds > 0)
+				m->import_last_rate = bytes / seconds;
+		}
+	}
+
+	fclose(fp);
+}
+
+static int
+add_je(struct metrics *m, zfs_handle_t *zhp, const char *jail,
+    const char *active)
+{
+	struct je_metrics *jem;
+
+	if (m->njes == m->alloc) {
+		m->alloc = m->alloc == 0 ? 64 : m->alloc * 2;
+		m->jes = reallocf(m->jes, m->alloc * sizeof(*m->jes));
+		if (m->jes == NULL) {
+			m->njes = m->alloc = 0;
+			return (ENOMEM);
+		}
+	}
+
+	jem = &m->jes[m->njes++];
+	strlcpy(jem->dataset, zfs_get_name(zhp), sizeof(jem->dataset));
+	jem->jail = jail;
+	jem->used = zfs_prop_get_int(zhp, ZFS_PROP_USED);
+	jem->referenced = zfs_prop_get_int(zhp, ZFS_PROP_REFERENCED);
+	jem->created = zfs_prop_get_int(zhp, ZFS_PROP_CREATION);
+	jem->active = active != NULL && strcmp(active, jem->dataset) == 0;
+
+	return (0);
+}
+
+struct collect_info {
+	struct metrics *m;
+	const char *jail;
+	const char *active;
+};
+
+static int
+collect_je_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct collect_info *ci = arg;
+
+	if (!je_persistent(zhp))
+		add_je(ci->m, zhp, ci->jail, ci->active);
+	zfs_close(zhp);
+	return (0);
+}
+
+static int
+collect_jail_cb(zfs_handle_t *jds, void *arg)
+{
+	struct metrics *m = arg;
+	struct jail_metrics *jm;
+	struct collect_info ci;
+	zfs_handle_t *je, *candidate;
+	size_t first;
+	const char *name;
+
+	/* not a jail dataset */
+	if ((je = get_active_je(m->hdl, jds)) == NULL) {
+		zfs_close(jds);
+		return (0);
+	}
+
+	m->jails = reallocf(m->jails, (m->njails + 1) * sizeof(*m->jails));
+	if (m->jails == NULL) {
+		m->njails = 0;
+		zfs_close(je);
+		zfs_close(jds);
+		return (ENOMEM);
+	}
+
+	jm = &m->jails[m->njails++];
+	memset(jm, 0, sizeof(*jm));
+	name = strrchr(zfs_get_name(jds), '/');
+	strlcpy(jm->name, name != NULL ? name + 1 : zfs_get_name(jds),
+	    sizeof(jm->name));
+	jm->active_created = zfs_prop_get_int(je, ZFS_PROP_CREATION);
+
+	if ((candidate = je_candidate(m->hdl, jds)) != NULL) {
+		jm->candidate_created = zfs_prop_get_int(candidate,
+		    ZFS_PROP_CREATION);
+		zfs_close(candidate);
+	}
+
+	first = m->njes;
+	ci.m = m;
+	ci.jail = NULL;
+	ci.active = zfs_get_name(je);
+	zfs_iter_filesystems(jds, collect_je_cb, &ci);
+	jm->njes = m->njes - first;
+
+	zfs_close(je);
+	zfs_close(jds);
+	return (0);
+}
+
+static int
+collect(struct metrics *m)
+{
+	int i;
+	size_t j, k;
+	struct collect_info ci;
+	zfs_handle_t *zhp;
+
+	for (i = 0; i < m->hdl->njeroots; i++) {
+		if ((zhp = zfs_open(m->hdl->lzh, m->hdl->jeroots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(zhp, collect_jail_cb, m);
+		zfs_close(zhp);
+	}
+
+	/*
+	 * m->jails moves while it grows, point jail environments at the
+	 * names once it is complete. They were gathered in jail order.
+	 */
+	for (j = 0, k = 0; j < m->njails; j++) {
+		for (i = 0; i < m->jails[j].njes; i++)
+			m->jes[k++].jail = m->jails[j].name;
+	}
+
+	ci.m = m;
+	ci.jail = NULL;
+	ci.active = NULL;
+	for (i = 0; i < m->hdl->njepools; i++) {
+		if ((zhp = zfs_open(m->hdl->lzh, m->hdl->jepools[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(zhp, collect_je_cb, &ci);
+		zfs_close(zhp);
+	}
+
+	return (0);
+}
+
+static void
+print_family(FILE *fp, const char *name, const char *type, const char *help)
+{
+	fprintf(fp, "# TYPE %s %s\n", name, type);
+	fprintf(fp, "# HELP %s %s\n", name, help);
+}
+
+static void
+print_metrics(FILE *fp, struct metrics *m)
+{
+	size_t i, j;
+	struct jail_metrics *jm;
+	struct je_metrics *jem;
+	struct histogram *h;
+	int64_t lag;
+
+	print_family(fp, "jectl_jail_environments", "gauge",
+	    "Jail environments held by the jail.");
+	for (i = 0; i < m->njails; i++)
+		fprintf(fp, "jectl_jail_environments{jail=\"%s\"} %d\n",
+		    m->jails[i].name, m->jails[i].njes);
+
+	print_family(fp, "jectl_active_created_seconds", "gauge",
+	    "Creation time of the active jail environment.");
+	for (i = 0; i < m->njails; i++)
+		fprintf(fp, "jectl_active_created_seconds{jail=\"%s\"} %ju\n",
+		    m->jails[i].name, (uintmax_t)m->jails[i].active_created);
+
+	print_family(fp, "jectl_candidate_created_seconds", "gauge",
+	    "Creation time of the newest jail environment the jail can update to.");
+	for (i = 0; i < m->njails; i++) {
+		jm = &m->jails[i];
+		if (jm->candidate_created != 0)
+			fprintf(fp, "jectl_candidate_created_seconds{jail=\"%s\"} %ju\n",
+			    jm->name, (uintmax_t)jm->candidate_created);
+	}
+
+	print_family(fp, "jectl_update_lag_seconds", "gauge",
+	    "Age of the active jail environment relative to the newest candidate.");
+	for (i = 0; i < m->njails; i++) {
+		jm = &m->jails[i];
+		lag = 0;
+		if (jm->candidate_created > jm->active_created)
+			lag = jm->candidate_created - jm->active_created;
+		fprintf(fp, "jectl_update_lag_seconds{jail=\"%s\"} %jd\n",
+		    jm->name, (intmax_t)lag);
+	}
+
+	print_family(fp, "jectl_last_swap_seconds", "gauge",
+	    "Time of the last jail environment swap.");
+	for (i = 0; i < m->njails; i++) {
+		jm = &m->jails[i];
+		if (jm->last_swap != 0)
+			fprintf(fp, "jectl_last_swap_seconds{jail=\"%s\"} %ju\n",
+			    jm->name, (uintmax_t)jm->last_swap);
+	}
+
+	print_family(fp, "jectl_je_used_bytes", "gauge",
+	    "Space used by the jail environment and its descendants.");
+	for (i = 0; i < m->njes; i++) {
+		jem = &m->jes[i];
+		fprintf(fp, "jectl_je_used_bytes{dataset=\"%s\",jail=\"%s\"} %ju\n",
+		    jem->dataset, jem->jail != NULL ? jem->jail : "",
+		    (uintmax_t)jem->used);
+	}
+
+	print_family(fp, "jectl_je_referenced_bytes", "gauge",
+	    "Data referenced by the jail environment.");
+	for (i = 0; i < m->njes; i++) {
+		jem = &m->jes[i];
+		fprintf(fp, "jectl_je_referenced_bytes{dataset=\"%s\",jail=\"%s\"} %ju\n",
+		    jem->dataset, jem->jail != NULL ? jem->jail : "",
+		    (uintmax_t)jem->referenced);
+	}
+
+	print_family(fp, "jectl_je_created_seconds", "gauge",
+	    "Creation time of the jail environment.");
+	for (i = 0; i < m->njes; i++) {
+		jem = &m->jes[i];
+		fprintf(fp, "jectl_je_created_seconds{dataset=\"%s\",jail=\"%s\"} %ju\n",
+		    jem->dataset, jem->jail != NULL ? jem->jail : "",
+		    (uintmax_t)jem->created);
+	}
+
+	print_family(fp, "jectl_je_active", "gauge",
+	    "Whether the jail environment is the active one of its jail.");
+	for (i = 0; i < m->njes; i++) {
+		jem = &m->jes[i];
+		if (jem->jail != NULL)
+			fprintf(fp, "jectl_je_active{dataset=\"%s\",jail=\"%s\"} %d\n",
+			    jem->dataset, jem->jail, jem->active);
+	}
+
+	print_family(fp, "jectl_phase_duration_seconds", "histogram",
+	    "Duration of the phases of swaps, mounts and imports.");
+	for (i = 0; i < m->nhists; i++) {
+		h = &m->hists[i];
+		for (j = 0; j < nitems(buckets); j++)
+			fprintf(fp, "jectl_phase_duration_seconds_bucket"
+			    "{op=\"%s\",phase=\"%s\",le=\"%g\"} %ju\n",
+			    h->op, h->phase, buckets[j], (uintmax_t)h->counts[j]);
+		fprintf(fp, "jectl_phase_duration_seconds_bucket"
+		    "{op=\"%s\",phase=\"%s\",le=\"+Inf\"} %ju\n",
+		    h->op, h->phase, (uintmax_t)h->count);
+		fprintf(fp, "jectl_phase_duration_seconds_count"
+		    "{op=\"%s\",phase=\"%s\"} %ju\n",
+		    h->op, h->phase, (uintmax_t)h->count);
+		fprintf(fp, "jectl_phase_duration_seconds_sum"
+		    "{op=\"%s\",phase=\"%s\"} %.6f\n", h->op, h->phase, h->sum);
+	}
+
+	print_family(fp, "jectl_import_bytes", "counter",
+	    "Bytes received by imports.");
+	fprintf(fp, "jectl_import_bytes_total %ju\n", (uintmax_t)m->import_bytes);
+
+	print_family(fp, "jectl_import_receive_seconds", "counter",
+	    "Time spent receiving imports.");
+	fprintf(fp, "jectl_import_receive_seconds_total %.6f\n", m->import_seconds);
+
+	print_family(fp, "jectl_import_last_throughput_bytes_per_second", "gauge",
+	    "Throughput of the most recent import.");
+	fprintf(fp, "jectl_import_last_throughput_bytes_per_second %.0f\n",
+	    m->import_last_rate);
+
+	fprintf(fp, "# EOF\n");
+}
+
+/* print the metrics of every jail and jail environment to fp */
+int
+je_metrics(libjectl_handle_t *hdl, FILE *fp)
+{
+	int error;
+	struct metrics m = { 0 };
+	char old[MAXPATHLEN];
+
+	m.hdl = hdl;
+
+	if ((error = collect(&m)) == 0) {
+		/* oldest first, the last import rate comes from the newest */
+		snprintf(old, sizeof(old), "%s.0", metrics_log());
+		load_samples(&m, old);
+		load_samples(&m, metrics_log());
+		print_metrics(fp, &m);
+	}
+
+	free(m.jails);
+	free(m.jes);
+	return (error);
+}
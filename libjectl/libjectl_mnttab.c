@@ -0,0 +1,274 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/ucred.h>
+#include <sys/mount.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Snapshot of the mounted ZFS file systems, hashed by dataset and by
+ * mountpoint. zfs_is_mounted() looks through the mount table for every
+ * call, with thousands of mounted jail datasets bulk operations turn
+ * quadratic. The snapshot is taken on first use, kept up to date as jectl
+ * mounts and unmounts, and dropped by libjectl_flush() at the end of a
+ * batch of operations so the next batch sees changes made by others.
+ */
+struct mnttab_entry {
+	char *special;
+	char *mountp;
+	struct mnttab_entry *ds_next;
+	struct mnttab_entry *path_next;
+};
+
+struct je_mnttab {
+	struct mnttab_entry **by_ds;
+	struct mnttab_entry **by_path;
+	size_t size;		/* buckets, a power of two */
+};
+
+/* FNV-1a */
+static size_t
+mnttab_hash(struct je_mnttab *mt, const char *s)
+{
+	uint64_t h;
+
+	h = 0xcbf29ce484222325ULL;
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return (h & (mt->size - 1));
+}
+
+static void
+mnttab_insert(struct je_mnttab *mt, const char *special, const char *mountp)
+{
+	size_t h;
+	struct mnttab_entry *me;
+
+	if ((me = calloc(1, sizeof(*me))) == NULL)
+		return;
+	me->special = strdup(special);
+	me->mountp = strdup(mountp);
+	if (me->special == NULL || me->mountp == NULL) {
+		free(me->special);
+		free(me->mountp);
+		free(me);
+		return;
+	}
+
+	/* stacked mounts, the latest one hides those below it */
+	h = mnttab_hash(mt, me->special);
+	me->ds_next = mt->by_ds[h];
+	mt->by_ds[h] = me;
+
+	h = mnttab_hash(mt, me->mountp);
+	me->path_next = mt->by_path[h];
+	mt->by_path[h] = me;
+}
+
+/*
+ * getfsstat(2) into a buffer of our own, getmntinfo(3) keeps its buffer
+ * in a static and cannot be used by several handles at once.
+ */
+static struct je_mnttab *
+mnttab_load(libjectl_handle_t *hdl)
+{
+	int i, count;
+	struct statfs *sfs;
+	struct je_mnttab *mt;
+
+	if (hdl->mnttab != NULL)
+		return (hdl->mnttab);
+
+	sfs = NULL;
+	for (;;) {
+		/* MNT_NOWAIT, an unresponsive file system must not hold us up */
+		if ((count = getfsstat(NULL, 0, MNT_NOWAIT)) < 0)
+			return (NULL);
+		/* room for file systems mounted in between */
+		count += 16;
+		if ((sfs = reallocf(sfs, count * sizeof(*sfs))) == NULL)
+			return (NULL);
+		i = getfsstat(sfs, count * sizeof(*sfs), MNT_NOWAIT);
+		if (i < 0) {
+			free(sfs);
+			return (NULL);
+		}
+		if (i < count)
+			break;
+	}
+	count = i;
+
+	if ((mt = calloc(1, sizeof(*mt))) == NULL) {
+		free(sfs);
+		return (NULL);
+	}
+
+	/* keep chains short, the table is not resized as mounts are added */
+	for (mt->size = 64; mt->size < (size_t)count * 2;)
+		mt->size *= 2;
+
+	mt->by_ds = calloc(mt->size, sizeof(*mt->by_ds));
+	mt->by_path = calloc(mt->size, sizeof(*mt->by_path));
+	if (mt->by_ds == NULL || mt->by_path == NULL) {
+		free(mt->by_ds);
+		free(mt->by_path);
+		free(mt);
+		free(sfs);
+		return (NULL);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (strcmp(sfs[i].f_fstypename, MNTTYPE_ZFS) != 0)
+			continue;
+		mnttab_insert(mt, sfs[i].f_mntfromname, sfs[i].f_mntonname);
+	}
+
+	free(sfs);
+	hdl->mnttab = mt;
+	return (mt);
+}
+
+static struct mnttab_entry *
+mnttab_find_ds(struct je_mnttab *mt, const char *special)
+{
+	struct mnttab_entry *me;
+
+	for (me = mt->by_ds[mnttab_hash(mt, special)]; me != NULL; me = me->ds_next) {
+		if (strcmp(me->special, special) == 0)
+			return (me);
+	}
+
+	return (NULL);
+}
+
+/* record that special was mounted at mountp */
+void
+je_mnttab_add(libjectl_handle_t *hdl, const char *special, const char *mountp)
+{
+	struct je_mnttab *mt;
+
+	if ((mt = mnttab_load(hdl)) != NULL)
+		mnttab_insert(mt, special, mountp);
+}
+
+/* record that special was unmounted */
+void
+je_mnttab_remove(libjectl_handle_t *hdl, const char *special)
+{
+	struct je_mnttab *mt;
+	struct mnttab_entry *me, **mep;
+
+	if ((mt = mnttab_load(hdl)) == NULL ||
+	    (me = mnttab_find_ds(mt, special)) == NULL)
+		return;
+
+	for (mep = &mt->by_ds[mnttab_hash(mt, special)]; *mep != me;
+	    mep = &(*mep)->ds_next)
+		;
+	*mep = me->ds_next;
+
+	for (mep = &mt->by_path[mnttab_hash(mt, me->mountp)]; *mep != me;
+	    mep = &(*mep)->path_next)
+		;
+	*mep = me->path_next;
+
+	free(me->special);
+	free(me->mountp);
+	free(me);
+}
+
+/* drop the snapshot, the next lookup takes a new one */
+void
+je_mnttab_flush(libjectl_handle_t *hdl)
+{
+	size_t i;
+	struct je_mnttab *mt;
+	struct mnttab_entry *me, *next;
+
+	if ((mt = hdl->mnttab) == NULL)
+		return;
+
+	for (i = 0; i < mt->size; i++) {
+		for (me = mt->by_ds[i]; me != NULL; me = next) {
+			next = me->ds_next;
+			free(me->special);
+			free(me->mountp);
+			free(me);
+		}
+	}
+
+	free(mt->by_ds);
+	free(mt->by_path);
+	free(mt);
+	hdl->mnttab = NULL;
+}
+
+/*
+ * like zfs_is_mounted(), where (if not NULL) is set to an allocated copy
+ * of the mountpoint. Falls back to libzfs if no snapshot can be taken.
+ */
+bool
+je_is_mounted(libjectl_handle_t *hdl, zfs_handle_t *zhp, char **where)
+{
+	struct je_mnttab *mt;
+	struct mnttab_entry *me;
+
+	if ((mt = mnttab_load(hdl)) == NULL)
+		return (zfs_is_mounted(zhp, where));
+
+	if ((me = mnttab_find_ds(mt, zfs_get_name(zhp))) == NULL)
+		return (false);
+
+	if (where != NULL && (*where = strdup(me->mountp)) == NULL)
+		return (false);
+
+	return (true);
+}
+
+/* dataset mounted on top of path, NULL if none */
+const char *
+je_mnttab_dataset(libjectl_handle_t *hdl, const char *path)
+{
+	struct je_mnttab *mt;
+	struct mnttab_entry *me;
+
+	if ((mt = mnttab_load(hdl)) == NULL)
+		return (NULL);
+
+	for (me = mt->by_path[mnttab_hash(mt, path)]; me != NULL; me = me->path_next) {
+		if (strcmp(me->mountp, path) == 0)
+			return (me->special);
+	}
+
+	return (NULL);
+}
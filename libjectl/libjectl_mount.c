@@ -0,0 +1,461 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <pthread.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+#define	MOUNT_MAXTHREADS	16
+
+static int
+gather_cb(zfs_handle_t *zhp, void *arg __unused)
+{
+	get_all_cb_t *cb = arg;
+
+	if (zfs_get_type(zhp) == ZFS_TYPE_FILESYSTEM) {
+		libzfs_add_handle(cb, zhp);
+		zfs_iter_filesystems(zhp, gather_cb, cb);
+	} else
+		zfs_close(zhp);
+
+	return (0);
+}
+
+/*
+ * gather je and its descendants, parents come before their children.
+ * je itself is duplicated, the caller keeps its own handle.
+ */
+void
+je_gather(zfs_handle_t *je, get_all_cb_t *cb)
+{
+	libzfs_add_handle(cb, zfs_handle_dup(je));
+	zfs_iter_filesystems(je, gather_cb, cb);
+}
+
+void
+je_gather_free(get_all_cb_t *cb)
+{
+	size_t i;
+
+	for (i = 0; i < cb->cb_used; i++)
+		zfs_close(cb->cb_handles[i]);
+	free(cb->cb_handles);
+	cb->cb_handles = NULL;
+	cb->cb_used = cb->cb_alloc = 0;
+}
+
+static int
+persistent_cb(zfs_handle_t *zhp, void *arg)
+{
+	if (je_persistent(zhp))
+		libzfs_add_handle(arg, zhp);
+	else
+		zfs_close(zhp);
+
+	return (0);
+}
+
+static const char *
+persistent_mountpoint(zfs_handle_t *zhp)
+{
+	char *mp;
+
+	if (get_property(zhp, "je:mountpoint", &mp) != 0)
+		return ("");
+	return (mp);
+}
+
+static int
+persistent_compare(const void *a, const void *b)
+{
+	return (strcmp(persistent_mountpoint(*(zfs_handle_t * const *)a),
+	    persistent_mountpoint(*(zfs_handle_t * const *)b)));
+}
+
+/*
+ * gather the persistent datasets kept beside the jail environments of
+ * jds and their descendants. Sorted by je:mountpoint, a dataset comes
+ * after the one it is mounted in.
+ */
+void
+je_gather_persistent(zfs_handle_t *jds, get_all_cb_t *cb)
+{
+	size_t i;
+	get_all_cb_t top = { 0 };
+
+	zfs_iter_filesystems(jds, persistent_cb, &top);
+	qsort(top.cb_handles, top.cb_used, sizeof(*top.cb_handles),
+	    persistent_compare);
+
+	for (i = 0; i < top.cb_used; i++) {
+		libzfs_add_handle(cb, top.cb_handles[i]);
+		zfs_iter_filesystems(top.cb_handles[i], gather_cb, cb);
+	}
+	free(top.cb_handles);
+}
+
+/*
+ * Where a persistent dataset goes when its jail is mounted at mountpoint:
+ * at je:mountpoint below it, descendants keep their place relative to
+ * the dataset je:mountpoint is set on.
+ */
+static void
+persistent_mount_path(zfs_handle_t *zhp, const char *mountpoint, char *path,
+    size_t len)
+{
+	nvlist_t *propval;
+	char *mp, *source;
+	const char *rel;
+
+	if (nvlist_lookup_nvlist(zfs_get_user_props(zhp), "je:mountpoint",
+	    &propval) != 0 ||
+	    nvlist_lookup_string(propval, ZPROP_VALUE, &mp) != 0 ||
+	    nvlist_lookup_string(propval, ZPROP_SOURCE, &source) != 0) {
+		snprintf(path, len, "%s", mountpoint);
+		return;
+	}
+
+	rel = zfs_get_name(zhp) + strlen(source);
+
+	if (strcmp(mountpoint, "/") == 0)
+		mountpoint = "";
+
+	snprintf(path, len, "%s%s%s%s", mountpoint, *mp == '/' ? "" : "/", mp,
+	    rel);
+}
+
+/*
+ * Where a dataset of the jail environment je goes when je is mounted at
+ * mountpoint; descendants keep their place relative to je.
+ */
+static void
+je_mount_path(zfs_handle_t *je, zfs_handle_t *zhp, const char *mountpoint,
+    char *path, size_t len)
+{
+	const char *rel;
+
+	rel = zfs_get_name(zhp) + strlen(zfs_get_name(je));
+
+	if (strcmp(mountpoint, "/") == 0 && *rel != '\0')
+		mountpoint = "";
+
+	snprintf(path, len, "%s%s", mountpoint, rel);
+}
+
+/*
+ * Should zhp be mounted along with its jail environment je. A descendant
+ * that has mountpoint=none set on itself, rather than inherited from je,
+ * opted out.
+ */
+static bool
+je_mountable(zfs_handle_t *je, zfs_handle_t *zhp)
+{
+	zprop_source_t src;
+	char mp[ZFS_MAXPROPLEN];
+
+	if (zfs_prop_get_int(zhp, ZFS_PROP_CANMOUNT) == ZFS_CANMOUNT_OFF)
+		return (false);
+
+	zfs_prop_get(zhp, ZFS_PROP_MOUNTPOINT, mp, sizeof(mp), &src, NULL, 0,
+	    B_FALSE);
+
+	if (strcmp(mp, ZFS_MOUNTPOINT_LEGACY) == 0)
+		return (false);
+
+	if (zhp != je && strcmp(mp, ZFS_MOUNTPOINT_NONE) == 0 &&
+	    (src & (ZPROP_SRC_LOCAL | ZPROP_SRC_RECEIVED)) != 0)
+		return (false);
+
+	return (true);
+}
+
+/*
+ * Where the gathered dataset i goes, false if it stays unmounted. The
+ * jail environment and its descendants are the first nje, persistent
+ * datasets follow.
+ */
+static bool
+jail_mount_path(get_all_cb_t *cb, size_t nje, size_t i,
+    const char *mountpoint, char *path, size_t len)
+{
+	zfs_handle_t *je, *zhp;
+
+	je = cb->cb_handles[0];
+	zhp = cb->cb_handles[i];
+
+	if (i >= nje) {
+		if (zfs_prop_get_int(zhp, ZFS_PROP_CANMOUNT) == ZFS_CANMOUNT_OFF)
+			return (false);
+		persistent_mount_path(zhp, mountpoint, path, len);
+		return (true);
+	}
+
+	if (!je_mountable(je, zhp))
+		return (false);
+	je_mount_path(je, zhp, mountpoint, path, len);
+	return (true);
+}
+
+/* is every dataset of the jail mounted where it belongs */
+static bool
+je_mounted_at(libjectl_handle_t *hdl, get_all_cb_t *cb, size_t nje,
+    const char *mountpoint)
+{
+	size_t i;
+	char path[MAXPATHLEN];
+	const char *ds;
+
+	for (i = 0; i < cb->cb_used; i++) {
+		if (!jail_mount_path(cb, nje, i, mountpoint, path, sizeof(path)))
+			continue;
+		if ((ds = je_mnttab_dataset(hdl, path)) == NULL ||
+		    strcmp(ds, zfs_get_name(cb->cb_handles[i])) != 0)
+			return (false);
+	}
+
+	return (true);
+}
+
+/*
+ * Datasets are mounted in waves, in parallel within a wave: the jail
+ * environment one level of the mount path at a time, then the persistent
+ * datasets on top of it the same way. zfs_foreach_mountpoint cannot
+ * order them, it goes by the mountpoint property, none for all of them.
+ * As there, the threads share the libzfs handle.
+ */
+struct mount_entry {
+	zfs_handle_t *zhp;
+	char path[MAXPATHLEN];
+	bool persistent;
+	int depth;
+	int error;
+};
+
+struct mount_wave {
+	pthread_mutex_t lock;
+	struct mount_entry *v;
+	size_t next;
+	size_t end;
+};
+
+static int
+mount_entry_compare(const void *a, const void *b)
+{
+	const struct mount_entry *ma = a, *mb = b;
+
+	if (ma->persistent != mb->persistent)
+		return (ma->persistent ? 1 : -1);
+	return (ma->depth - mb->depth);
+}
+
+static void *
+mount_thread(void *arg)
+{
+	struct mount_wave *mw = arg;
+	struct mount_entry *e;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&mw->lock);
+		i = mw->next++;
+		pthread_mutex_unlock(&mw->lock);
+		if (i >= mw->end)
+			break;
+
+		e = &mw->v[i];
+		e->error = zfs_mount_at(e->zhp, NULL, 0, e->path) != 0;
+	}
+
+	return (NULL);
+}
+
+/* mount v[start] to v[end - 1], which do not depend on each other */
+static void
+mount_wave(struct mount_entry *v, size_t start, size_t end)
+{
+	int i, nthreads;
+	pthread_t tids[MOUNT_MAXTHREADS];
+	struct mount_wave mw = { .v = v, .next = start, .end = end };
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > MOUNT_MAXTHREADS)
+		nthreads = MOUNT_MAXTHREADS;
+	if ((size_t)nthreads > end - start)
+		nthreads = end - start;
+
+	pthread_mutex_init(&mw.lock, NULL);
+	/* a single mount is not worth a thread */
+	for (i = 0; nthreads > 1 && i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, mount_thread, &mw) != 0)
+			break;
+	}
+	nthreads = i;
+	/* no thread to spare, do it ourselves */
+	if (nthreads == 0)
+		mount_thread(&mw);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&mw.lock);
+}
+
+static int
+mount_all(libjectl_handle_t *hdl, get_all_cb_t *cb, size_t nje,
+    const char *mountpoint)
+{
+	int error;
+	size_t i, n, start, end;
+	struct mount_entry *v, *e;
+	const char *p;
+
+	if ((v = calloc(cb->cb_used, sizeof(*v))) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	n = 0;
+	for (i = 0; i < cb->cb_used; i++) {
+		e = &v[n];
+		if (!jail_mount_path(cb, nje, i, mountpoint, e->path,
+		    sizeof(e->path)))
+			continue;
+		e->zhp = cb->cb_handles[i];
+		e->persistent = i >= nje;
+		for (p = e->path; *p != '\0'; p++)
+			e->depth += *p == '/';
+		n++;
+	}
+	qsort(v, n, sizeof(*v), mount_entry_compare);
+
+	error = 0;
+	for (start = 0; start < n && error == 0; start = end) {
+		for (end = start + 1; end < n &&
+		    mount_entry_compare(&v[start], &v[end]) == 0; end++)
+			;
+		mount_wave(v, start, end);
+
+		for (i = start; i < end; i++) {
+			e = &v[i];
+			if (e->error != 0 && error == 0)
+				error = je_error(hdl, JE_ERR_MOUNT,
+				    "cannot mount '%s' at '%s'",
+				    zfs_get_name(e->zhp), e->path);
+			else if (e->error == 0)
+				je_mnttab_add(hdl, zfs_get_name(e->zhp),
+				    e->path);
+		}
+	}
+
+	free(v);
+	return (error);
+}
+
+/*
+ * Mount jail at given mountpoint.
+ *
+ * The mountpoint property is left alone, the jail environment is mounted
+ * at a temporary mountpoint instead. Setting the property costs a txg
+ * sync for every jail start, which queues up behind heavy write load.
+ *
+ * Persistent datasets kept beside the jail environments are mounted on
+ * top, at je:mountpoint below mountpoint. Datasets are mounted in
+ * parallel where their paths allow, see mount_all.
+ */
+int
+je_mount_impl(libjectl_handle_t *hdl, zfs_handle_t *jds, const char *mountpoint)
+{
+	int error;
+	size_t nje;
+	zfs_handle_t *je;
+	get_all_cb_t cb = { 0 };
+	uint64_t start, t;
+
+	start = je_now_ns();
+
+	if ((je = get_active_je(hdl, jds)) == NULL)
+		return (je_error(hdl, JE_ERR_NOACTIVE,
+		    "cannot find active jail environment for '%s'",
+		    zfs_get_name(jds)));
+
+	je_gather(je, &cb);
+	nje = cb.cb_used;
+	je_gather_persistent(jds, &cb);
+
+	/* already mounted right here, e.g. a jail restart */
+	if (je_mounted_at(hdl, &cb, nje, mountpoint)) {
+		je_gather_free(&cb);
+		zfs_close(je);
+		return (0);
+	}
+
+	/*
+	 * XXX: work-around dying jails
+	 *
+	 * A dying jail can prevent the backing dataset from being unmounted.
+	 * Do a forced unmount until dying jails can be cleaned properly.
+	 */
+	if ((error = je_unmount_persistent(hdl, jds, MNT_FORCE)) != 0 ||
+	    (error = je_unmount_impl(hdl, je, MNT_FORCE)) != 0) {
+		je_gather_free(&cb);
+		zfs_close(je);
+		return (error);
+	}
+	je_metrics_sample(zfs_get_name(jds), "mount", "unmount",
+	    je_now_ns() - start, 0);
+
+	t = je_now_ns();
+	error = mount_all(hdl, &cb, nje, mountpoint);
+
+	if (error == 0) {
+		je_metrics_sample(zfs_get_name(jds), "mount", "mount",
+		    je_now_ns() - t, 0);
+		je_metrics_sample(zfs_get_name(jds), "mount", "total",
+		    je_now_ns() - start, 0);
+	}
+
+	je_gather_free(&cb);
+	zfs_close(je);
+
+	return (error);
+}
+
+/* mount the active jail environment of jail at mountpoint */
+int
+je_mount(libjectl_handle_t *hdl, const char *jail, const char *mountpoint)
+{
+	int error;
+	zfs_handle_t *jds;
+
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (hdl->error);
+
+	error = je_mount_impl(hdl, jds, mountpoint);
+
+	zfs_close(jds);
+
+	return (error);
+}
@@ -0,0 +1,461 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Native replacement for bootstrap_links and the overlay copy in
+ * generate-je.sh. The overlay directory is walked once; symbolic links
+ * pointing into /config have what they replace moved into the config
+ * dataset (or dropped, for jail environment updates), then the overlay is
+ * copied over the world, like cp -fRPp would.
+ */
+
+#define	CONFIG_PREFIX	"/config/"
+
+struct overlay_entry {
+	char *path;		/* relative to the overlay directory */
+	struct stat sb;
+	char *link;		/* target of a symbolic link */
+};
+
+struct overlay {
+	struct overlay_entry *entries;
+	size_t count;
+	size_t alloc;
+};
+
+/*
+ * copy the contents of regular file src to dst, with copy_file_range(2)
+ * so a filesystem that supports it can clone the blocks instead.
+ */
+static int
+copy_file(const char *src, const char *dst, const struct stat *sb)
+{
+	int in, out, error;
+	ssize_t n;
+	char buf[MAXBSIZE];
+
+	if ((in = open(src, O_RDONLY)) < 0)
+		return (errno);
+
+	/* cp -f: if the target cannot be opened, remove it and try again */
+	if ((out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, sb->st_mode & 07777)) < 0) {
+		unlink(dst);
+		out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, sb->st_mode & 07777);
+	}
+	if (out < 0) {
+		error = errno;
+		close(in);
+		return (error);
+	}
+
+	error = 0;
+	while ((n = copy_file_range(in, NULL, out, NULL, SSIZE_MAX, 0)) > 0)
+		;
+
+	/* not supported between these files, copy by hand */
+	if (n < 0 && (errno == EINVAL || errno == ENOSYS || errno == EXDEV)) {
+		while ((n = read(in, buf, sizeof(buf))) > 0) {
+			if (write(out, buf, n) != n) {
+				n = -1;
+				break;
+			}
+		}
+	}
+	if (n < 0)
+		error = errno;
+
+	close(in);
+	if (close(out) != 0 && error == 0)
+		error = errno;
+
+	return (error);
+}
+
+/* cp -p: preserve owner, mode, times and flags */
+static void
+copy_attrs(const char *dst, const struct stat *sb)
+{
+	struct timespec times[2];
+
+	times[0] = sb->st_atim;
+	times[1] = sb->st_mtim;
+
+	lchown(dst, sb->st_uid, sb->st_gid);
+	if (!S_ISLNK(sb->st_mode))
+		chmod(dst, sb->st_mode & 07777);
+	utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+	lchflags(dst, sb->st_flags);
+}
+
+/* rm -rf */
+static int
+remove_tree(const char *path)
+{
+	FTS *fts;
+	FTSENT *ent;
+	char *paths[] = { (char *)path, NULL };
+	int error;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		return (errno);
+
+	error = 0;
+	while ((ent = fts_read(fts)) != NULL) {
+		switch (ent->fts_info) {
+		case FTS_D:
+			break;
+		case FTS_DP:
+			if (rmdir(ent->fts_accpath) != 0)
+				error = errno;
+			break;
+		default:
+			if (unlink(ent->fts_accpath) != 0)
+				error = errno;
+			break;
+		}
+	}
+
+	fts_close(fts);
+	return (error);
+}
+
+/*
+ * copy a single entry to dst, existing entries of another type are
+ * replaced. Directories get their attributes set by the caller once
+ * their contents are in place.
+ */
+static int
+copy_entry(libjectl_handle_t *hdl, const char *src, const char *dst,
+    const struct stat *sb, const char *link)
+{
+	struct stat dsb;
+	char target[MAXPATHLEN];
+	ssize_t len;
+	int error;
+	bool exists;
+
+	exists = lstat(dst, &dsb) == 0;
+
+	if (S_ISDIR(sb->st_mode)) {
+		if (exists && S_ISDIR(dsb.st_mode))
+			return (0);
+		if (exists && unlink(dst) != 0)
+			return (errno);
+		return (mkdir(dst, sb->st_mode & 07777) != 0 ? errno : 0);
+	}
+
+	if (exists && S_ISDIR(dsb.st_mode) && (error = remove_tree(dst)) != 0)
+		return (error);
+
+	if (S_ISLNK(sb->st_mode)) {
+		if (link == NULL) {
+			if ((len = readlink(src, target, sizeof(target) - 1)) < 0)
+				return (errno);
+			target[len] = '\0';
+			link = target;
+		}
+		unlink(dst);
+		if (symlink(link, dst) != 0)
+			return (errno);
+		copy_attrs(dst, sb);
+		return (0);
+	}
+
+	if (S_ISREG(sb->st_mode)) {
+		if (exists && !S_ISREG(dsb.st_mode))
+			unlink(dst);
+		if ((error = copy_file(src, dst, sb)) != 0)
+			return (error);
+		copy_attrs(dst, sb);
+		return (0);
+	}
+
+	/* device nodes, fifos and sockets have no place in an overlay */
+	je_warn(hdl, "skipping special file %s", src);
+	return (0);
+}
+
+/*
+ * cp -fRPp src dst, merging the contents of directory src into dst. Every
+ * entry that cannot be copied is reported, the last error is returned.
+ */
+int
+je_copy_tree(libjectl_handle_t *hdl, const char *src, const char *dst)
+{
+	FTS *fts;
+	FTSENT *ent;
+	char *paths[] = { (char *)src, NULL };
+	char path[MAXPATHLEN];
+	size_t len;
+	int error, rc;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", src,
+		    strerror(errno)));
+
+	len = strlen(src);
+	error = 0;
+	while ((ent = fts_read(fts)) != NULL) {
+		snprintf(path, sizeof(path), "%s%s", dst, ent->fts_path + len);
+
+		switch (ent->fts_info) {
+		case FTS_DP:
+			copy_attrs(path, ent->fts_statp);
+			break;
+		case FTS_DNR:
+		case FTS_ERR:
+		case FTS_NS:
+			error = je_error(hdl, JE_ERR_IO, "%s: %s",
+			    ent->fts_path, strerror(ent->fts_errno));
+			break;
+		default:
+			rc = copy_entry(hdl, ent->fts_accpath, path,
+			    ent->fts_statp, NULL);
+			if (rc != 0)
+				error = je_error(hdl, JE_ERR_IO,
+				    "cannot copy %s to %s: %s", ent->fts_path,
+				    path, strerror(rc));
+			break;
+		}
+	}
+
+	fts_close(fts);
+	return (error);
+}
+
+/* mkdir -p */
+static int
+mkdirs(const char *path)
+{
+	char buf[MAXPATHLEN];
+	char *p;
+
+	strlcpy(buf, path, sizeof(buf));
+	for (p = buf + 1; *p != '\0'; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(buf, 0755) != 0 && errno != EEXIST)
+			return (errno);
+		*p = '/';
+	}
+	if (mkdir(buf, 0755) != 0 && errno != EEXIST)
+		return (errno);
+
+	return (0);
+}
+
+/*
+ * Move world/path, replaced by a link to the config dataset, to
+ * world/target. A rename is enough when both are on the same dataset,
+ * otherwise it is copied and removed.
+ */
+static int
+move_to_config(libjectl_handle_t *hdl, const char *world, const char *path,
+    const char *target)
+{
+	char src[MAXPATHLEN], dst[MAXPATHLEN], dir[MAXPATHLEN];
+	int error;
+
+	snprintf(src, sizeof(src), "%s/%s", world, path);
+	snprintf(dst, sizeof(dst), "%s%s", world, target);
+	strlcpy(dir, dst, sizeof(dir));
+
+	je_info(hdl, "moving %s to %s", path, target);
+
+	if ((error = mkdirs(dirname(dir))) != 0)
+		return (je_error(hdl, JE_ERR_IO, "cannot create %s: %s", dir,
+		    strerror(error)));
+
+	if (rename(src, dst) == 0)
+		return (0);
+
+	if (errno != EXDEV && errno != ENOTEMPTY && errno != EEXIST &&
+	    errno != EISDIR &&
+	    errno != ENOTDIR)
+		return (je_error(hdl, JE_ERR_IO, "cannot move %s to %s: %s",
+		    src, dst, strerror(errno)));
+
+	if ((error = je_copy_tree(hdl, src, dst)) != 0)
+		return (error);
+
+	if ((error = remove_tree(src)) != 0)
+		return (je_error(hdl, JE_ERR_IO, "cannot remove %s: %s", src,
+		    strerror(error)));
+
+	return (0);
+}
+
+static int
+overlay_add(struct overlay *ov, FTSENT *ent, size_t skip)
+{
+	struct overlay_entry *oe;
+	char target[MAXPATHLEN];
+	ssize_t len;
+
+	if (ov->count == ov->alloc) {
+		ov->alloc = ov->alloc == 0 ? 1024 : ov->alloc * 2;
+		ov->entries = reallocf(ov->entries, ov->alloc * sizeof(*oe));
+		if (ov->entries == NULL)
+			return (ENOMEM);
+	}
+
+	oe = &ov->entries[ov->count];
+	oe->sb = *ent->fts_statp;
+	oe->link = NULL;
+	if ((oe->path = strdup(ent->fts_path + skip)) == NULL)
+		return (ENOMEM);
+
+	if (S_ISLNK(oe->sb.st_mode)) {
+		if ((len = readlink(ent->fts_accpath, target, sizeof(target) - 1)) < 0)
+			return (errno);
+		target[len] = '\0';
+		if ((oe->link = strdup(target)) == NULL)
+			return (ENOMEM);
+	}
+
+	ov->count++;
+	return (0);
+}
+
+static void
+overlay_free(struct overlay *ov)
+{
+	size_t i;
+
+	for (i = 0; i < ov->count; i++) {
+		free(ov->entries[i].path);
+		free(ov->entries[i].link);
+	}
+	free(ov->entries);
+}
+
+/*
+ * Apply overlay to world. In update mode (a jail environment only stream)
+ * the files replaced by links into /config are removed, the config dataset
+ * of the jail already has them.
+ */
+int
+je_overlay_apply(libjectl_handle_t *hdl, const char *overlay,
+    const char *world, bool update)
+{
+	FTS *fts;
+	FTSENT *ent;
+	struct overlay ov = { 0 };
+	struct overlay_entry *oe;
+	struct stat sb;
+	char *paths[] = { (char *)overlay, NULL };
+	char src[MAXPATHLEN], dst[MAXPATHLEN];
+	size_t i, skip;
+	int error;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", overlay,
+		    strerror(errno)));
+
+	/* entries are recorded as relative paths, "etc/rc.conf" */
+	skip = strlen(overlay) + 1;
+	error = 0;
+	while ((ent = fts_read(fts)) != NULL && error == 0) {
+		switch (ent->fts_info) {
+		case FTS_DP:
+			break;
+		case FTS_DNR:
+		case FTS_ERR:
+		case FTS_NS:
+			error = je_error(hdl, JE_ERR_IO, "%s: %s",
+			    ent->fts_path, strerror(ent->fts_errno));
+			break;
+		default:
+			if (ent->fts_level > FTS_ROOTLEVEL &&
+			    (error = overlay_add(&ov, ent, skip)) != 0)
+				error = je_error(hdl, error == ENOMEM ?
+				    JE_ERR_NOMEM : JE_ERR_IO, "%s: %s",
+				    ent->fts_path, strerror(error));
+			break;
+		}
+	}
+	fts_close(fts);
+
+	/* links into the config dataset take over what they replace */
+	for (i = 0; i < ov.count && error == 0; i++) {
+		oe = &ov.entries[i];
+		if (oe->link == NULL ||
+		    strncmp(oe->link, CONFIG_PREFIX, strlen(CONFIG_PREFIX)) != 0)
+			continue;
+
+		snprintf(dst, sizeof(dst), "%s/%s", world, oe->path);
+		if (stat(dst, &sb) != 0)
+			continue;
+
+		if (!update) {
+			error = move_to_config(hdl, world, oe->path, oe->link);
+			continue;
+		}
+
+		je_info(hdl, "removing %s from jail environment", oe->path);
+		if ((error = remove_tree(dst)) != 0)
+			error = je_error(hdl, JE_ERR_IO, "cannot remove %s: %s",
+			    dst, strerror(error));
+	}
+
+	for (i = 0; i < ov.count && error == 0; i++) {
+		oe = &ov.entries[i];
+		snprintf(src, sizeof(src), "%s/%s", overlay, oe->path);
+		snprintf(dst, sizeof(dst), "%s/%s", world, oe->path);
+		if ((error = copy_entry(hdl, src, dst, &oe->sb, oe->link)) != 0)
+			error = je_error(hdl, JE_ERR_IO,
+			    "cannot copy %s to %s: %s", src, dst,
+			    strerror(error));
+	}
+
+	/* directory attributes last, filling them in touched their times */
+	for (i = ov.count; i-- > 0 && error == 0;) {
+		oe = &ov.entries[i];
+		if (!S_ISDIR(oe->sb.st_mode))
+			continue;
+		snprintf(dst, sizeof(dst), "%s/%s", world, oe->path);
+		copy_attrs(dst, &oe->sb);
+	}
+
+	overlay_free(&ov);
+	return (error);
+}
@@ -0,0 +1,367 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/file.h>
+#include <fcntl.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * The warm pool is a set of ready jail datasets kept in $jeroot/.warm,
+ * each one already holding a clone of the template jail environment with
+ * je:active set. Taking one is a rename into place, a property update
+ * and a mount; the slow part, cloning and setting properties, was done
+ * ahead of time by je_pool_fill.
+ *
+ * $jeroot/.warm carries je:warm:template and je:warm:size so a refill
+ * needs no arguments. It has no je:active of its own and is passed over
+ * wherever jail datasets are listed.
+ */
+#define	JE_WARM_POOL	".warm"
+#define	POOL_LOCK	"/var/run/jectl.pool"
+
+static int
+pool_entry_cb(zfs_handle_t *zhp, void *arg)
+{
+	libzfs_add_handle(arg, zhp);
+	return (0);
+}
+
+/* the warm pool of the first jeroot having one */
+static zfs_handle_t *
+pool_open(libjectl_handle_t *hdl)
+{
+	int i;
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+
+	for (i = 0; i < hdl->njeroots; i++) {
+		snprintf(name, sizeof(name), "%s/%s", hdl->jeroots[i],
+		    JE_WARM_POOL);
+		if (zfs_dataset_exists(hdl->lzh, name, ZFS_TYPE_FILESYSTEM))
+			return (zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM));
+	}
+
+	return (NULL);
+}
+
+static zfs_handle_t *
+pool_create(libjectl_handle_t *hdl)
+{
+	nvlist_t *props;
+	zfs_handle_t *zhp;
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+
+	snprintf(name, sizeof(name), "%s/%s", je_place(hdl, JE_ROOT_JEROOT),
+	    JE_WARM_POOL);
+
+	if (nvlist_alloc(&props, NV_UNIQUE_NAME, 0) != 0) {
+		je_error(hdl, JE_ERR_NOMEM, "out of memory");
+		return (NULL);
+	}
+	nvlist_add_string(props, "canmount", "off");
+	nvlist_add_string(props, "mountpoint", "none");
+
+	if (zfs_create(hdl->lzh, name, ZFS_TYPE_FILESYSTEM, props) != 0) {
+		nvlist_free(props);
+		je_error(hdl, JE_ERR_ZFSCREATE, "cannot create %s", name);
+		return (NULL);
+	}
+	nvlist_free(props);
+	je_info(hdl, "created %s", name);
+
+	if ((zhp = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+		je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", name);
+	return (zhp);
+}
+
+/* template of a ready entry, NULL while it is being built */
+static const char *
+entry_template(zfs_handle_t *entry)
+{
+	char *active;
+
+	if (get_property(entry, "je:active", &active) != 0)
+		return (NULL);
+	return (strrchr(active, '/') + 1);
+}
+
+/* build one entry, a jail dataset with template active */
+static int
+entry_create(libjectl_handle_t *hdl, const char *name, const char *template)
+{
+	int error;
+	nvlist_t *props;
+	zfs_handle_t *zhp;
+
+	if (nvlist_alloc(&props, NV_UNIQUE_NAME, 0) != 0)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+	nvlist_add_string(props, "canmount", "off");
+	nvlist_add_string(props, "mountpoint", "none");
+
+	error = zfs_create(hdl->lzh, name, ZFS_TYPE_FILESYSTEM, props);
+	nvlist_free(props);
+	if (error != 0)
+		return (je_error(hdl, JE_ERR_ZFSCREATE, "cannot create %s",
+		    name));
+
+	if ((zhp = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return (je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", name));
+
+	/* je:active is set last, an entry without it is not ready */
+	if ((error = je_activate_impl(hdl, zhp, template)) != 0)
+		je_destroy(zhp);
+	else
+		je_info(hdl, "created %s", name);
+
+	zfs_close(zhp);
+	return (error);
+}
+
+static int
+pool_fill(libjectl_handle_t *hdl, zfs_handle_t *pool, const char *template,
+    long size)
+{
+	int error;
+	long n, ready;
+	size_t i;
+	const char *t;
+	zfs_handle_t *entry;
+	get_all_cb_t cb = { 0 };
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+
+	zfs_iter_filesystems(pool, pool_entry_cb, &cb);
+
+	/*
+	 * Drop entries of another template, the surplus and whatever an
+	 * interrupted fill left behind; fills are serialized, nobody is
+	 * building one right now.
+	 */
+	ready = 0;
+	for (i = 0; i < cb.cb_used; i++) {
+		entry = cb.cb_handles[i];
+		if ((t = entry_template(entry)) != NULL &&
+		    strcmp(t, template) == 0 && ready < size) {
+			ready++;
+			continue;
+		}
+		if (je_destroy(entry) == 0)
+			je_info(hdl, "destroyed %s", zfs_get_name(entry));
+	}
+	je_gather_free(&cb);
+
+	error = 0;
+	for (n = 0; ready < size; n++) {
+		snprintf(name, sizeof(name), "%s/%ld", zfs_get_name(pool), n);
+		if (zfs_dataset_exists(hdl->lzh, name, ZFS_TYPE_FILESYSTEM))
+			continue;
+		if ((error = entry_create(hdl, name, template)) != 0)
+			break;
+		ready++;
+	}
+
+	return (error);
+}
+
+/*
+ * Bring the warm pool to size entries of template. A NULL template or a
+ * negative size stand for the ones of the previous fill.
+ */
+int
+je_pool_fill(libjectl_handle_t *hdl, const char *template, long size)
+{
+	int error, fd;
+	char *recorded, *end;
+	char buf[32];
+	char tmpl[ZFS_MAX_DATASET_NAME_LEN];
+	nvlist_t *props;
+	zfs_handle_t *pool;
+
+	if (template != NULL && (*template == '\0' ||
+	    strchr(template, '/') != NULL))
+		return (je_error(hdl, JE_ERR_INVALIDARG,
+		    "invalid jail environment name '%s'", template));
+
+	/* a refill after every take, let them queue up */
+	if ((fd = open(POOL_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+		return (je_error(hdl, JE_ERR_IO, "cannot open %s: %s",
+		    POOL_LOCK, strerror(errno)));
+	if (flock(fd, LOCK_EX) != 0) {
+		error = je_error(hdl, JE_ERR_IO, "cannot lock %s: %s",
+		    POOL_LOCK, strerror(errno));
+		close(fd);
+		return (error);
+	}
+
+	if ((pool = pool_open(hdl)) == NULL) {
+		if (template == NULL || size < 0) {
+			close(fd);
+			return (je_error(hdl, JE_ERR_INVALIDARG,
+			    "no warm pool, a template and size are required"));
+		}
+		if ((pool = pool_create(hdl)) == NULL) {
+			close(fd);
+			return (hdl->error);
+		}
+	}
+
+	/*
+	 * recorded points into the properties of pool, which setting them
+	 * below frees, copy what is needed out first.
+	 */
+	if (template == NULL && get_property(pool, "je:warm:template",
+	    &recorded) == 0) {
+		strlcpy(tmpl, recorded, sizeof(tmpl));
+		template = tmpl;
+	}
+	if (size < 0 && get_property(pool, "je:warm:size", &recorded) == 0) {
+		strlcpy(buf, recorded, sizeof(buf));
+		size = strtol(buf, &end, 10);
+		if (*end != '\0')
+			size = -1;
+	}
+
+	if (template == NULL || size < 0) {
+		error = je_error(hdl, JE_ERR_INVALIDARG,
+		    "'%s' has no template or size recorded", zfs_get_name(pool));
+		goto out;
+	}
+
+	if (!je_exists(hdl, JE_ROOT_JEPOOL, template)) {
+		error = je_error(hdl, JE_ERR_NOENT,
+		    "cannot find jail environment '%s'", template);
+		goto out;
+	}
+
+	if (nvlist_alloc(&props, NV_UNIQUE_NAME, 0) != 0) {
+		error = je_error(hdl, JE_ERR_NOMEM, "out of memory");
+		goto out;
+	}
+	snprintf(buf, sizeof(buf), "%ld", size);
+	nvlist_add_string(props, "je:warm:template", template);
+	nvlist_add_string(props, "je:warm:size", buf);
+	error = zfs_prop_set_list(pool, props);
+	nvlist_free(props);
+	if (error != 0) {
+		error = je_error(hdl, JE_ERR_ZFSPROP, "cannot set properties on '%s'",
+		    zfs_get_name(pool));
+		goto out;
+	}
+
+	error = pool_fill(hdl, pool, template, size);
+out:
+	zfs_close(pool);
+	close(fd);
+	return (error);
+}
+
+/*
+ * Rename an entry into $jeroot/jail. Another take may rename the same
+ * entry first, move on to the next one then.
+ */
+static int
+pool_take(libjectl_handle_t *hdl, const char *root, const char *jail,
+    char *active, size_t len)
+{
+	size_t i;
+	const char *t;
+	zfs_handle_t *pool;
+	get_all_cb_t cb = { 0 };
+	struct renameflags flags = { .nounmount = 1 };
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+
+	snprintf(name, sizeof(name), "%s/%s", root, JE_WARM_POOL);
+	if (!zfs_dataset_exists(hdl->lzh, name, ZFS_TYPE_FILESYSTEM))
+		return (ENOENT);
+	if ((pool = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return (ENOENT);
+	zfs_iter_filesystems(pool, pool_entry_cb, &cb);
+	zfs_close(pool);
+
+	snprintf(name, sizeof(name), "%s/%s", root, jail);
+	for (i = 0; i < cb.cb_used; i++) {
+		if ((t = entry_template(cb.cb_handles[i])) == NULL)
+			continue;
+		snprintf(active, len, "%s/%s", name, t);
+		if (zfs_rename(cb.cb_handles[i], name, flags) == 0) {
+			je_gather_free(&cb);
+			return (0);
+		}
+	}
+
+	je_gather_free(&cb);
+	return (ENOENT);
+}
+
+/* turn a warm pool entry into jail and mount it at mountpoint */
+int
+je_pool_take(libjectl_handle_t *hdl, const char *jail, const char *mountpoint)
+{
+	int i, error;
+	zfs_handle_t *jds;
+	char active[ZFS_MAX_DATASET_NAME_LEN];
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t start, t;
+
+	if (*jail == '\0' || *jail == '.' || strchr(jail, '/') != NULL)
+		return (je_error(hdl, JE_ERR_INVALIDARG, "invalid jail name '%s'",
+		    jail));
+
+	if (je_exists(hdl, JE_ROOT_JEROOT, jail))
+		return (je_error(hdl, JE_ERR_EXISTS,
+		    "cannot take '%s': jail dataset already exists", jail));
+
+	start = je_now_ns();
+	for (i = 0; i < hdl->njeroots; i++) {
+		if (pool_take(hdl, hdl->jeroots[i], jail, active,
+		    sizeof(active)) == 0)
+			break;
+	}
+	if (i == hdl->njeroots)
+		return (je_error(hdl, JE_ERR_NOENT,
+		    "cannot take '%s': the warm pool is empty", jail));
+	je_metrics_sample(jail, "take", "rename", je_now_ns() - start, 0);
+
+	snprintf(name, sizeof(name), "%s/%s", hdl->jeroots[i], jail);
+	if ((jds = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return (je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", name));
+
+	/* je:active still names the entry the jail environment was built in */
+	t = je_now_ns();
+	if (zfs_prop_set(jds, "je:active", active) != 0) {
+		zfs_close(jds);
+		return (je_error(hdl, JE_ERR_ZFSPROP,
+		    "cannot set je:active on '%s'", name));
+	}
+	je_metrics_sample(jail, "take", "propset", je_now_ns() - t, 0);
+
+	if ((error = je_mount_impl(hdl, jds, mountpoint)) == 0)
+		je_metrics_sample(jail, "take", "total", je_now_ns() - start, 0);
+
+	zfs_close(jds);
+	return (error);
+}
@@ -0,0 +1,357 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#include <fcntl.h>
+#include <jail.h>
+#include <libprocstat.h>
+#include <pthread.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * The prewarm manifest is a newline separated list of paths, relative to
+ * the root of the jail, stored on the jail dataset in user properties
+ * je:prewarm:0 ... je:prewarm:N. It is recorded from the files mapped by
+ * the processes of a running jail, and replayed after mounting a jail
+ * environment so the first start after an update doesn't read cold.
+ * Files that were only read(2), like configuration, are not covered.
+ */
+#define	PREWARM_CHUNK		8000	/* user properties are limited to 8k */
+#define	PREWARM_MAXCHUNKS	64
+#define	PREWARM_MAXTHREADS	16
+
+struct prewarm_info {
+	const char *root;
+	char **paths;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+};
+
+/*
+ * collect the vnodes mapped by every process of the running jail,
+ * paths are made relative to root.
+ */
+static int
+collect_paths(libjectl_handle_t *hdl, const char *jailname, const char *root,
+    nvlist_t *paths)
+{
+	int jid;
+	unsigned int i, j, nprocs, nmaps;
+	size_t len;
+	struct procstat *ps;
+	struct kinfo_proc *procs;
+	struct kinfo_vmentry *maps;
+
+	if ((jid = jail_getid(jailname)) < 0)
+		return (je_error(hdl, JE_ERR_INVALIDARG, "%s", jail_errmsg));
+
+	if ((ps = procstat_open_sysctl()) == NULL)
+		return (je_error(hdl, JE_ERR_UNKNOWN, "cannot open procstat"));
+
+	if ((procs = procstat_getprocs(ps, KERN_PROC_PROC, 0, &nprocs)) == NULL) {
+		procstat_close(ps);
+		return (je_error(hdl, JE_ERR_UNKNOWN, "cannot list processes"));
+	}
+
+	len = strlen(root);
+	for (i = 0; i < nprocs; i++) {
+		if (procs[i].ki_jid != jid)
+			continue;
+
+		maps = procstat_getvmmap(ps, &procs[i], &nmaps);
+		if (maps == NULL)
+			continue;
+
+		for (j = 0; j < nmaps; j++) {
+			if (maps[j].kve_type != KVME_TYPE_VNODE ||
+			    strncmp(maps[j].kve_path, root, len) != 0 ||
+			    maps[j].kve_path[len] != '/')
+				continue;
+			nvlist_add_boolean(paths, maps[j].kve_path + len);
+		}
+
+		procstat_freevmmap(ps, maps);
+	}
+
+	procstat_freeprocs(ps, procs);
+	procstat_close(ps);
+	return (0);
+}
+
+/*
+ * store the manifest on the jail dataset in a single zfs_prop_set_list,
+ * chunks left over from a previous, larger manifest are unset. Paths that
+ * don't fit are left out with a warning.
+ */
+static int
+store_manifest(libjectl_handle_t *hdl, zfs_handle_t *jds, nvlist_t *paths)
+{
+	int error, chunk;
+	size_t len, plen, toolong, dropped;
+	nvpair_t *nvp;
+	nvlist_t *props;
+	char prop[ZFS_MAXPROPLEN];
+	char *buf, *value;
+
+	if ((buf = malloc(PREWARM_CHUNK)) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	nvlist_alloc(&props, NV_UNIQUE_NAME, KM_SLEEP);
+
+	chunk = 0;
+	len = 0;
+	toolong = dropped = 0;
+	nvp = NULL;
+	while ((nvp = nvlist_next_nvpair(paths, nvp)) != NULL) {
+		plen = strlen(nvpair_name(nvp));
+		if (plen + 2 > PREWARM_CHUNK) {
+			toolong++;
+			continue;
+		}
+		if (len + plen + 2 > PREWARM_CHUNK) {
+			if (chunk == PREWARM_MAXCHUNKS - 1) {
+				dropped++;
+				continue;
+			}
+			snprintf(prop, sizeof(prop), "je:prewarm:%d", chunk++);
+			nvlist_add_string(props, prop, buf);
+			len = 0;
+		}
+		len += snprintf(buf + len, PREWARM_CHUNK - len, "%s%s",
+		    len == 0 ? "" : "\n", nvpair_name(nvp));
+	}
+	if (len > 0) {
+		snprintf(prop, sizeof(prop), "je:prewarm:%d", chunk++);
+		nvlist_add_string(props, prop, buf);
+	}
+
+	if (toolong > 0)
+		je_warn(hdl, "'%s': %zu paths too long for the prewarm "
+		    "manifest", zfs_get_name(jds), toolong);
+	if (dropped > 0)
+		je_warn(hdl, "'%s': prewarm manifest full, %zu paths left out",
+		    zfs_get_name(jds), dropped);
+
+	for (; chunk < PREWARM_MAXCHUNKS; chunk++) {
+		snprintf(prop, sizeof(prop), "je:prewarm:%d", chunk);
+		if (get_property(jds, prop, &value) != 0)
+			break;
+		nvlist_add_string(props, prop, "");
+	}
+
+	if (zfs_prop_set_list(jds, props) != 0)
+		error = je_error(hdl, JE_ERR_ZFSPROP,
+		    "cannot store prewarm manifest on '%s'", zfs_get_name(jds));
+	else
+		error = 0;
+
+	nvlist_free(props);
+	free(buf);
+	return (error);
+}
+
+/* record the prewarm manifest of a running jail */
+int
+je_prewarm_record(libjectl_handle_t *hdl, const char *jailname)
+{
+	int error;
+	char *root;
+	nvlist_t *paths;
+	zfs_handle_t *je, *jds;
+
+	if ((jds = get_jail_dataset(hdl, jailname)) == NULL)
+		return (hdl->error);
+
+	if ((je = get_active_je(hdl, jds)) == NULL) {
+		error = je_error(hdl, JE_ERR_NOACTIVE,
+		    "cannot find active jail environment for '%s'",
+		    zfs_get_name(jds));
+		zfs_close(jds);
+		return (error);
+	}
+
+	if (!je_is_mounted(hdl, je, &root)) {
+		error = je_error(hdl, JE_ERR_MOUNT, "'%s' is not mounted",
+		    zfs_get_name(je));
+		zfs_close(je);
+		zfs_close(jds);
+		return (error);
+	}
+
+	if (nvlist_alloc(&paths, NV_UNIQUE_NAME, 0) != 0) {
+		error = je_error(hdl, JE_ERR_NOMEM, "out of memory");
+	} else {
+		error = collect_paths(hdl, jailname, root, paths);
+		if (error == 0)
+			error = store_manifest(hdl, jds, paths);
+		nvlist_free(paths);
+	}
+
+	free(root);
+	zfs_close(je);
+	zfs_close(jds);
+	return (error);
+}
+
+static void *
+prewarm_thread(void *arg)
+{
+	int fd;
+	size_t i;
+	struct prewarm_info *pi;
+	char path[MAXPATHLEN];
+	char *buf;
+
+	pi = arg;
+
+	if ((buf = malloc(MAXPHYS)) == NULL)
+		return (NULL);
+
+	for (;;) {
+		pthread_mutex_lock(&pi->lock);
+		i = pi->next++;
+		pthread_mutex_unlock(&pi->lock);
+
+		if (i >= pi->count)
+			break;
+
+		snprintf(path, sizeof(path), "%s%s", pi->root, pi->paths[i]);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			continue;
+		/* reading the file is what pulls it into the ARC */
+		while (read(fd, buf, MAXPHYS) > 0)
+			;
+		close(fd);
+	}
+
+	free(buf);
+	return (NULL);
+}
+
+/*
+ * read every file listed in the manifest of jds below root, in parallel
+ */
+static int
+prewarm_impl(zfs_handle_t *jds, const char *root)
+{
+	int chunk, i, nthreads;
+	size_t alloc;
+	char prop[ZFS_MAXPROPLEN];
+	char *value, *copies[PREWARM_MAXCHUNKS], *p, *line;
+	pthread_t tids[PREWARM_MAXTHREADS];
+	struct prewarm_info pi = { 0 };
+
+	pi.root = root;
+	alloc = 0;
+
+	for (chunk = 0; chunk < PREWARM_MAXCHUNKS; chunk++) {
+		snprintf(prop, sizeof(prop), "je:prewarm:%d", chunk);
+		if (get_property(jds, prop, &value) != 0)
+			break;
+
+		/* nvlist strings belong to the handle, split a copy */
+		p = copies[chunk] = strdup(value);
+		while ((line = strsep(&p, "\n")) != NULL) {
+			if (*line == '\0')
+				continue;
+			if (pi.count == alloc) {
+				alloc = alloc == 0 ? 256 : alloc * 2;
+				pi.paths = reallocf(pi.paths, alloc * sizeof(char *));
+				if (pi.paths == NULL)
+					goto out;
+			}
+			pi.paths[pi.count++] = line;
+		}
+	}
+
+	if (pi.count == 0)
+		goto out;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > PREWARM_MAXTHREADS)
+		nthreads = PREWARM_MAXTHREADS;
+
+	pthread_mutex_init(&pi.lock, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, prewarm_thread, &pi) != 0)
+			break;
+	}
+	nthreads = i;
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_mutex_destroy(&pi.lock);
+
+out:
+	while (chunk-- > 0)
+		free(copies[chunk]);
+	free(pi.paths);
+	return (0);
+}
+
+/* read the files recorded for jail below root, the mounted jail */
+int
+je_prewarm(libjectl_handle_t *hdl, const char *jail, const char *root)
+{
+	int error;
+	zfs_handle_t *jds;
+
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (hdl->error);
+
+	error = prewarm_impl(jds, root);
+
+	zfs_close(jds);
+	return (error);
+}
+
+/* has a prewarm manifest been recorded for jail */
+bool
+je_prewarm_recorded(libjectl_handle_t *hdl, const char *jail)
+{
+	bool recorded;
+	char *value;
+	zfs_handle_t *jds;
+
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (false);
+
+	recorded = get_property(jds, "je:prewarm:0", &value) == 0;
+
+	zfs_close(jds);
+	return (recorded);
+}
@@ -0,0 +1,388 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Property profiles. A profile is a named set of dataset properties,
+ * applied when a dataset is created: as receive overrides by je_import
+ * and as clone properties by je_copy, so that data is written with them
+ * from the start rather than rewritten later. The profile a dataset was
+ * created with is kept in je:profile, clones of it get the same one.
+ *
+ * The built-in profiles can be replaced, and new ones added, with a
+ * je:profile:<name> user property on any of the roots, holding a comma
+ * separated list of property=value.
+ */
+struct je_profile {
+	const char *name;
+	const char *props;
+};
+
+static const struct je_profile profiles[] = {
+	/* the world, read-mostly */
+	{ "base", "compression=zstd,recordsize=1M,atime=off" },
+	/* small files rewritten in place */
+	{ "config", "compression=lz4,recordsize=16K,atime=off" },
+	/* appended to, rarely read back */
+	{ "logs", "compression=zstd,recordsize=16K,primarycache=metadata,"
+	    "logbias=throughput,atime=off" },
+	/* databases and other persistent data */
+	{ "data", "compression=lz4,recordsize=16K,logbias=latency,atime=off" },
+};
+
+/* je:profile:<name> of the first root having it, copied to buf */
+static const char *
+profile_override(libjectl_handle_t *hdl, const char *name, char *buf,
+    size_t len)
+{
+	int i, t, count;
+	const char * const *roots;
+	zfs_handle_t *zhp;
+	char prop[ZFS_MAXPROPLEN];
+	char *value;
+
+	snprintf(prop, sizeof(prop), "je:profile:%s", name);
+
+	for (t = JE_ROOT_JEPOOL; t <= JE_ROOT_JEROOT; t++) {
+		count = libjectl_get_roots(hdl, t, &roots);
+		for (i = 0; i < count; i++) {
+			if ((zhp = zfs_open(hdl->lzh, roots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			if (get_property(zhp, prop, &value) == 0) {
+				strlcpy(buf, value, len);
+				zfs_close(zhp);
+				return (buf);
+			}
+			zfs_close(zhp);
+		}
+	}
+
+	return (NULL);
+}
+
+static const char *
+profile_lookup(libjectl_handle_t *hdl, const char *name, char *buf,
+    size_t len)
+{
+	size_t i;
+	const char *props;
+
+	if ((props = profile_override(hdl, name, buf, len)) != NULL)
+		return (props);
+
+	for (i = 0; i < nitems(profiles); i++) {
+		if (strcmp(profiles[i].name, name) == 0)
+			return (profiles[i].props);
+	}
+
+	return (NULL);
+}
+
+/* add the properties of profile name to props, and je:profile itself */
+int
+je_profile_props(libjectl_handle_t *hdl, const char *name, nvlist_t *props)
+{
+	const char *list;
+	char *buf, *p, *prop, *value;
+	char override[ZFS_MAXPROPLEN];
+
+	if ((list = profile_lookup(hdl, name, override, sizeof(override))) == NULL)
+		return (je_error(hdl, JE_ERR_INVALIDARG, "unknown profile '%s'",
+		    name));
+
+	if ((buf = strdup(list)) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	p = buf;
+	while ((prop = strsep(&p, ",")) != NULL) {
+		if (*prop == '\0')
+			continue;
+		if ((value = strchr(prop, '=')) == NULL) {
+			free(buf);
+			return (je_error(hdl, JE_ERR_INVALIDARG,
+			    "profile '%s': expected property=value, got '%s'",
+			    name, prop));
+		}
+		*value++ = '\0';
+		nvlist_add_string(props, prop, value);
+	}
+	nvlist_add_string(props, "je:profile", name);
+
+	free(buf);
+	return (0);
+}
+
+/*
+ * add the profile zhp was created with to props, for datasets created
+ * from it; nothing when it has none
+ */
+int
+je_profile_of(libjectl_handle_t *hdl, zfs_handle_t *zhp, nvlist_t *props)
+{
+	char *name;
+
+	if (get_property(zhp, "je:profile", &name) != 0)
+		return (0);
+
+	return (je_profile_props(hdl, name, props));
+}
+
+/*
+ * Receive overrides only reach the top-level dataset of a stream, the
+ * rest inherits them. Descendants that came with a je:profile of their
+ * own, e.g. config, get theirs once received; they hold next to nothing
+ * at that point.
+ */
+static int
+profile_descendant_cb(zfs_handle_t *zhp, void *arg)
+{
+	libjectl_handle_t *hdl = arg;
+	nvlist_t *props, *nvl, *propval;
+	char *source;
+
+	nvl = zfs_get_user_props(zhp);
+	if (nvlist_lookup_nvlist(nvl, "je:profile", &propval) == 0 &&
+	    nvlist_lookup_string(propval, ZPROP_SOURCE, &source) == 0 &&
+	    strcmp(source, zfs_get_name(zhp)) == 0 &&
+	    nvlist_alloc(&props, NV_UNIQUE_NAME, 0) == 0) {
+		if (je_profile_of(hdl, zhp, props) == 0 &&
+		    zfs_prop_set_list(zhp, props) != 0)
+			je_error(hdl, JE_ERR_ZFSPROP,
+			    "cannot set profile properties on '%s'",
+			    zfs_get_name(zhp));
+		nvlist_free(props);
+	}
+
+	zfs_iter_filesystems(zhp, profile_descendant_cb, hdl);
+	zfs_close(zhp);
+	return (0);
+}
+
+void
+je_profile_descendants(libjectl_handle_t *hdl, zfs_handle_t *zhp)
+{
+	zfs_iter_filesystems(zhp, profile_descendant_cb, hdl);
+}
+
+static bool
+profile_builtin(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < nitems(profiles); i++) {
+		if (strcmp(profiles[i].name, name) == 0)
+			return (true);
+	}
+
+	return (false);
+}
+
+/* print the profiles and their properties, the built-in ones first */
+int
+je_profile_list(libjectl_handle_t *hdl, FILE *fp)
+{
+	int i, t, count;
+	size_t j;
+	const char * const *roots;
+	const char *name, *props;
+	zfs_handle_t *zhp;
+	nvpair_t *nvp;
+	char buf[ZFS_MAXPROPLEN];
+
+	for (j = 0; j < nitems(profiles); j++) {
+		props = profile_lookup(hdl, profiles[j].name, buf, sizeof(buf));
+		fprintf(fp, "%-8s %s%s\n", profiles[j].name, props,
+		    props == buf ? " (je:profile)" : "");
+	}
+
+	/* added on the roots, the first root defining one wins */
+	for (t = JE_ROOT_JEPOOL; t <= JE_ROOT_JEROOT; t++) {
+		count = libjectl_get_roots(hdl, t, &roots);
+		for (i = 0; i < count; i++) {
+			if ((zhp = zfs_open(hdl->lzh, roots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			nvp = NULL;
+			while ((nvp = nvlist_next_nvpair(zfs_get_user_props(zhp),
+			    nvp)) != NULL) {
+				if (strncmp(nvpair_name(nvp), "je:profile:", 11) != 0)
+					continue;
+				name = nvpair_name(nvp) + 11;
+				if (profile_builtin(name) ||
+				    profile_override(hdl, name, buf, sizeof(buf)) == NULL)
+					continue;
+				fprintf(fp, "%-8s %s (je:profile)\n", name, buf);
+			}
+			zfs_close(zhp);
+		}
+	}
+
+	return (0);
+}
+
+struct profile_usage {
+	char name[ZFS_MAXPROPLEN];
+	uint64_t datasets;
+	uint64_t used;
+	uint64_t referenced;
+	uint64_t logical;
+};
+
+struct report_info {
+	struct profile_usage *pu;
+	size_t count;
+	size_t alloc;
+};
+
+static int
+report_cb(zfs_handle_t *zhp, void *arg)
+{
+	struct report_info *ri = arg;
+	struct profile_usage *pu;
+	char *name;
+	size_t i;
+
+	if (get_property(zhp, "je:profile", &name) != 0)
+		name = "-";
+
+	for (i = 0; i < ri->count; i++) {
+		if (strcmp(ri->pu[i].name, name) == 0)
+			break;
+	}
+	if (i == ri->count) {
+		if (ri->count == ri->alloc) {
+			ri->alloc = ri->alloc == 0 ? 8 : ri->alloc * 2;
+			ri->pu = reallocf(ri->pu, ri->alloc * sizeof(*ri->pu));
+			if (ri->pu == NULL) {
+				ri->count = ri->alloc = 0;
+				zfs_close(zhp);
+				return (ENOMEM);
+			}
+		}
+		memset(&ri->pu[i], 0, sizeof(ri->pu[i]));
+		strlcpy(ri->pu[i].name, name, sizeof(ri->pu[i].name));
+		ri->count++;
+	}
+
+	pu = &ri->pu[i];
+	pu->datasets++;
+	/* usedbydataset, children are counted on their own */
+	pu->used += zfs_prop_get_int(zhp, ZFS_PROP_USEDDS);
+	pu->referenced += zfs_prop_get_int(zhp, ZFS_PROP_REFERENCED);
+	pu->logical += zfs_prop_get_int(zhp, ZFS_PROP_LOGICALREFERENCED);
+
+	zfs_iter_filesystems(zhp, report_cb, ri);
+	zfs_close(zhp);
+	return (0);
+}
+
+static uint64_t
+arcstat(const char *name)
+{
+	char oid[64];
+	uint64_t value;
+	size_t len;
+
+	snprintf(oid, sizeof(oid), "kstat.zfs.misc.arcstats.%s", name);
+	len = sizeof(value);
+	if (sysctlbyname(oid, &value, &len, NULL, 0) != 0)
+		return (0);
+	return (value);
+}
+
+/*
+ * Space and compression of the datasets under the roots, by profile;
+ * the ratio is logicalreferenced over referenced.
+ * The ARC keeps no per-dataset counters; the demand hit ratio is for
+ * the whole host, the metadata one shows how primarycache=metadata
+ * profiles fare.
+ */
+int
+je_profile_report(libjectl_handle_t *hdl, int flags, FILE *fp)
+{
+	int i, t, count;
+	size_t j;
+	const char * const *roots;
+	struct report_info ri = { 0 };
+	zfs_handle_t *zhp;
+	char used[32], referenced[32], logical[32];
+	uint64_t hits, misses;
+
+	for (t = JE_ROOT_JEPOOL; t <= JE_ROOT_JEROOT; t++) {
+		count = libjectl_get_roots(hdl, t, &roots);
+		for (i = 0; i < count; i++) {
+			if ((zhp = zfs_open(hdl->lzh, roots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			zfs_iter_filesystems(zhp, report_cb, &ri);
+			zfs_close(zhp);
+		}
+	}
+
+	if ((flags & JE_PROFILE_SCRIPTED) == 0)
+		fprintf(fp, "%-12s %8s %8s %8s %8s %6s\n", "PROFILE",
+		    "DATASETS", "USED", "REFER", "LREFER", "RATIO");
+
+	for (j = 0; j < ri.count; j++) {
+		if ((flags & JE_PROFILE_PARSABLE) != 0) {
+			snprintf(used, sizeof(used), "%ju",
+			    (uintmax_t)ri.pu[j].used);
+			snprintf(referenced, sizeof(referenced), "%ju",
+			    (uintmax_t)ri.pu[j].referenced);
+			snprintf(logical, sizeof(logical), "%ju",
+			    (uintmax_t)ri.pu[j].logical);
+		} else {
+			zfs_nicenum(ri.pu[j].used, used, sizeof(used));
+			zfs_nicenum(ri.pu[j].referenced, referenced,
+			    sizeof(referenced));
+			zfs_nicenum(ri.pu[j].logical, logical, sizeof(logical));
+		}
+		fprintf(fp, (flags & JE_PROFILE_SCRIPTED) != 0 ?
+		    "%s\t%ju\t%s\t%s\t%s\t%.2f\n" :
+		    "%-12s %8ju %8s %8s %8s %5.2fx\n",
+		    ri.pu[j].name, (uintmax_t)ri.pu[j].datasets, used, referenced,
+		    logical,
+		    (double)ri.pu[j].logical / MAX(ri.pu[j].referenced, 1));
+	}
+
+	if ((flags & JE_PROFILE_SCRIPTED) == 0) {
+		hits = arcstat("demand_data_hits");
+		misses = arcstat("demand_data_misses");
+		fprintf(fp, "\nARC demand data hit ratio: %.1f%%",
+		    100.0 * hits / MAX(hits + misses, 1));
+		hits = arcstat("demand_metadata_hits");
+		misses = arcstat("demand_metadata_misses");
+		fprintf(fp, ", metadata: %.1f%% (host)\n",
+		    100.0 * hits / MAX(hits + misses, 1));
+	}
+
+	free(ri.pu);
+	return (0);
+}
@@ -0,0 +1,891 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <limits.h>
+#include <pthread.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Rebase a freshly received jail environment onto the most similar one
+ * already in the jepools: clone that one and rewrite only the files whose
+ * contents differ from what was received, then let the clone take the
+ * place of the received dataset. Files that are the same keep sharing
+ * their blocks, on disk and in the ARC, with the jail environment the
+ * clone came from.
+ *
+ * Candidate files are compared byte for byte by a pool of threads. Files
+ * left alone keep the times of the clone; setting them would rewrite
+ * every dnode for no benefit.
+ */
+#define	REBASE_MAXTHREADS	16
+#define	REBASE_BUFSIZE		(128 * 1024)
+
+struct rebase_entry {
+	char *path;		/* relative, "/bin/sh" */
+	char *target;		/* hard links: the name to link to */
+	struct stat sb;		/* of the received entry */
+};
+
+struct rebase_list {
+	struct rebase_entry *v;
+	size_t count;
+	size_t alloc;
+};
+
+struct rebase {
+	const char *src;	/* the received jail environment, mounted */
+	const char *dst;	/* its clone to be */
+	struct rebase_list files;
+	struct rebase_list dirs;
+	struct rebase_list links;	/* further names of a hard link */
+	struct rebase_list inodes;	/* first name of each hard link */
+	size_t next;
+	uint64_t shared;	/* bytes left as they were */
+	uint64_t written;	/* bytes rewritten */
+	int error;
+	char failed[MAXPATHLEN];
+	pthread_mutex_t lock;
+};
+
+static int
+rebase_add(struct rebase_list *rl, const char *path, const struct stat *sb,
+    const char *target)
+{
+	struct rebase_entry *re;
+
+	if (rl->count == rl->alloc) {
+		rl->alloc = rl->alloc == 0 ? 1024 : rl->alloc * 2;
+		rl->v = reallocf(rl->v, rl->alloc * sizeof(*rl->v));
+		if (rl->v == NULL) {
+			rl->count = rl->alloc = 0;
+			return (ENOMEM);
+		}
+	}
+
+	re = &rl->v[rl->count];
+	re->sb = *sb;
+	re->target = NULL;
+	if ((re->path = strdup(path)) == NULL ||
+	    (target != NULL && (re->target = strdup(target)) == NULL)) {
+		free(re->path);
+		return (ENOMEM);
+	}
+	rl->count++;
+
+	return (0);
+}
+
+static void
+rebase_list_free(struct rebase_list *rl)
+{
+	size_t i;
+
+	for (i = 0; i < rl->count; i++) {
+		free(rl->v[i].path);
+		free(rl->v[i].target);
+	}
+	free(rl->v);
+}
+
+/* rm -rf, schg and friends included */
+static int
+rebase_remove(const char *path)
+{
+	FTS *fts;
+	FTSENT *ent;
+	char *paths[] = { (char *)path, NULL };
+	int error;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		return (errno);
+
+	error = 0;
+	while ((ent = fts_read(fts)) != NULL) {
+		if (ent->fts_info != FTS_DP && ent->fts_statp->st_flags != 0)
+			lchflags(ent->fts_accpath, 0);
+		switch (ent->fts_info) {
+		case FTS_D:
+			break;
+		case FTS_DP:
+			if (rmdir(ent->fts_accpath) != 0)
+				error = errno;
+			break;
+		default:
+			if (unlink(ent->fts_accpath) != 0)
+				error = errno;
+			break;
+		}
+	}
+
+	fts_close(fts);
+	return (error);
+}
+
+/*
+ * bring owner, mode and flags of dst in line with sb, dsb is what dst
+ * has now, NULL for a new entry that takes the times of sb as well
+ */
+static void
+rebase_attrs(const char *dst, const struct stat *sb, const struct stat *dsb)
+{
+	struct timespec times[2];
+	bool owner, mode;
+
+	owner = dsb == NULL || dsb->st_uid != sb->st_uid ||
+	    dsb->st_gid != sb->st_gid;
+	mode = !S_ISLNK(sb->st_mode) &&
+	    (dsb == NULL || (dsb->st_mode & 07777) != (sb->st_mode & 07777));
+
+	if (dsb != NULL && !owner && !mode && dsb->st_flags == sb->st_flags)
+		return;
+
+	if (dsb != NULL && dsb->st_flags != 0)
+		lchflags(dst, 0);
+	if (owner)
+		lchown(dst, sb->st_uid, sb->st_gid);
+	if (mode)
+		chmod(dst, sb->st_mode & 07777);
+	if (dsb == NULL) {
+		times[0] = sb->st_atim;
+		times[1] = sb->st_mtim;
+		utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+	}
+	if (sb->st_flags != 0 || (dsb != NULL && dsb->st_flags != 0))
+		lchflags(dst, sb->st_flags);
+}
+
+/* do regular files src and dst hold the same bytes */
+static bool
+rebase_same(const char *src, const char *dst, char *a, char *b)
+{
+	int sfd, dfd;
+	ssize_t n;
+	bool same;
+
+	if ((sfd = open(src, O_RDONLY)) < 0)
+		return (false);
+	if ((dfd = open(dst, O_RDONLY)) < 0) {
+		close(sfd);
+		return (false);
+	}
+
+	same = true;
+	while (same && (n = read(sfd, a, REBASE_BUFSIZE)) > 0) {
+		if (read(dfd, b, n) != n || memcmp(a, b, n) != 0)
+			same = false;
+	}
+	if (n < 0)
+		same = false;
+
+	close(sfd);
+	close(dfd);
+	return (same);
+}
+
+/*
+ * replace dst with a copy of src. A new file rather than a rewrite in
+ * place, the old one may be a hard link shared with other names.
+ */
+static int
+rebase_copy(const char *src, const char *dst, const struct stat *sb,
+    const struct stat *dsb, char *buf)
+{
+	int in, out, error;
+	ssize_t n;
+
+	if (dsb != NULL) {
+		if (dsb->st_flags != 0)
+			lchflags(dst, 0);
+		if (unlink(dst) != 0)
+			return (errno);
+	}
+
+	if ((in = open(src, O_RDONLY)) < 0)
+		return (errno);
+	if ((out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0) {
+		error = errno;
+		close(in);
+		return (error);
+	}
+
+	error = 0;
+	while ((n = copy_file_range(in, NULL, out, NULL, SSIZE_MAX, 0)) > 0)
+		;
+
+	/* not supported between these files, copy by hand */
+	if (n < 0 && (errno == EINVAL || errno == ENOSYS || errno == EXDEV)) {
+		while ((n = read(in, buf, REBASE_BUFSIZE)) > 0) {
+			if (write(out, buf, n) != n) {
+				n = -1;
+				break;
+			}
+		}
+	}
+	if (n < 0)
+		error = errno;
+
+	close(in);
+	if (close(out) != 0 && error == 0)
+		error = errno;
+
+	if (error == 0)
+		rebase_attrs(dst, sb, NULL);
+	return (error);
+}
+
+static void
+rebase_fail(struct rebase *rb, const char *path, int error)
+{
+	pthread_mutex_lock(&rb->lock);
+	if (rb->error == 0) {
+		rb->error = error;
+		strlcpy(rb->failed, path, sizeof(rb->failed));
+	}
+	pthread_mutex_unlock(&rb->lock);
+}
+
+static void *
+rebase_thread(void *arg)
+{
+	struct rebase *rb;
+	struct rebase_entry *re;
+	struct stat dsb;
+	size_t i;
+	int error;
+	bool exists;
+	char src[MAXPATHLEN], dst[MAXPATHLEN];
+	char *a, *b;
+
+	rb = arg;
+
+	a = malloc(REBASE_BUFSIZE);
+	b = malloc(REBASE_BUFSIZE);
+	if (a == NULL || b == NULL) {
+		rebase_fail(rb, rb->dst, ENOMEM);
+		goto out;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&rb->lock);
+		i = rb->next++;
+		if (rb->error != 0)
+			i = rb->files.count;
+		pthread_mutex_unlock(&rb->lock);
+
+		if (i >= rb->files.count)
+			break;
+
+		re = &rb->files.v[i];
+		snprintf(src, sizeof(src), "%s%s", rb->src, re->path);
+		snprintf(dst, sizeof(dst), "%s%s", rb->dst, re->path);
+
+		exists = lstat(dst, &dsb) == 0;
+		if (exists && S_ISREG(dsb.st_mode) &&
+		    dsb.st_size == re->sb.st_size && rebase_same(src, dst, a, b)) {
+			rebase_attrs(dst, &re->sb, &dsb);
+			pthread_mutex_lock(&rb->lock);
+			rb->shared += re->sb.st_size;
+			pthread_mutex_unlock(&rb->lock);
+			continue;
+		}
+
+		if ((error = rebase_copy(src, dst, &re->sb, exists ? &dsb : NULL,
+		    a)) != 0) {
+			rebase_fail(rb, dst, error);
+			break;
+		}
+		pthread_mutex_lock(&rb->lock);
+		rb->written += re->sb.st_size;
+		pthread_mutex_unlock(&rb->lock);
+	}
+
+out:
+	free(a);
+	free(b);
+	return (NULL);
+}
+
+/* remove what the clone has and the received jail environment has not */
+static int
+rebase_prune(struct rebase *rb)
+{
+	FTS *fts;
+	FTSENT *ent;
+	struct stat sb;
+	char *paths[] = { (char *)rb->dst, NULL };
+	char src[MAXPATHLEN];
+	size_t skip;
+	int error;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		return (errno);
+
+	skip = strlen(rb->dst);
+	error = 0;
+	while ((ent = fts_read(fts)) != NULL && error == 0) {
+		if (ent->fts_level == FTS_ROOTLEVEL || ent->fts_info == FTS_DP)
+			continue;
+		snprintf(src, sizeof(src), "%s%s", rb->src, ent->fts_path + skip);
+		if (lstat(src, &sb) == 0 || errno != ENOENT)
+			continue;
+		if (ent->fts_info == FTS_D)
+			fts_set(fts, ent, FTS_SKIP);
+		error = rebase_remove(ent->fts_accpath);
+	}
+
+	fts_close(fts);
+	return (error);
+}
+
+/* the first name seen of the hard link ent, NULL if ent is the first */
+static const char *
+rebase_inode(struct rebase *rb, FTSENT *ent, const char *path, int *error)
+{
+	size_t i;
+
+	for (i = 0; i < rb->inodes.count; i++) {
+		if (rb->inodes.v[i].sb.st_ino == ent->fts_statp->st_ino &&
+		    rb->inodes.v[i].sb.st_dev == ent->fts_statp->st_dev)
+			return (rb->inodes.v[i].path);
+	}
+
+	*error = rebase_add(&rb->inodes, path, ent->fts_statp, NULL);
+	return (NULL);
+}
+
+static int
+rebase_symlink(const char *src, const char *dst, const struct stat *sb,
+    const struct stat *dsb)
+{
+	char target[MAXPATHLEN], cur[MAXPATHLEN];
+	ssize_t len;
+
+	if ((len = readlink(src, target, sizeof(target) - 1)) < 0)
+		return (errno);
+	target[len] = '\0';
+
+	if (dsb != NULL && S_ISLNK(dsb->st_mode) &&
+	    (len = readlink(dst, cur, sizeof(cur) - 1)) >= 0) {
+		cur[len] = '\0';
+		if (strcmp(cur, target) == 0) {
+			rebase_attrs(dst, sb, dsb);
+			return (0);
+		}
+	}
+
+	if (dsb != NULL) {
+		if (dsb->st_flags != 0)
+			lchflags(dst, 0);
+		if (unlink(dst) != 0)
+			return (errno);
+	}
+	if (symlink(target, dst) != 0)
+		return (errno);
+	rebase_attrs(dst, sb, NULL);
+
+	return (0);
+}
+
+/*
+ * Walk the received jail environment: directories and symbolic links are
+ * dealt with on the way, regular files are queued for the threads.
+ */
+static int
+rebase_walk(struct rebase *rb)
+{
+	FTS *fts;
+	FTSENT *ent;
+	struct stat dsb;
+	char *paths[] = { (char *)rb->src, NULL };
+	char dst[MAXPATHLEN];
+	const char *rel, *first;
+	size_t skip;
+	int error;
+	bool exists;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		return (errno);
+
+	skip = strlen(rb->src);
+	error = 0;
+	while ((ent = fts_read(fts)) != NULL && error == 0) {
+		rel = ent->fts_path + skip;
+		snprintf(dst, sizeof(dst), "%s%s", rb->dst, rel);
+		exists = lstat(dst, &dsb) == 0;
+
+		switch (ent->fts_info) {
+		case FTS_D:
+			if (exists && !S_ISDIR(dsb.st_mode)) {
+				if ((error = rebase_remove(dst)) != 0)
+					break;
+				exists = false;
+			}
+			if (!exists && mkdir(dst, 0700) != 0)
+				error = errno;
+			else
+				error = rebase_add(&rb->dirs, rel, ent->fts_statp,
+				    NULL);
+			break;
+		case FTS_F:
+			if (exists && S_ISDIR(dsb.st_mode) &&
+			    (error = rebase_remove(dst)) != 0)
+				break;
+			first = NULL;
+			if (ent->fts_statp->st_nlink > 1 &&
+			    (first = rebase_inode(rb, ent, rel, &error)) == NULL &&
+			    error != 0)
+				break;
+			if (first != NULL)
+				error = rebase_add(&rb->links, rel, ent->fts_statp,
+				    first);
+			else
+				error = rebase_add(&rb->files, rel, ent->fts_statp,
+				    NULL);
+			break;
+		case FTS_SL:
+		case FTS_SLNONE:
+			if (exists && S_ISDIR(dsb.st_mode)) {
+				if ((error = rebase_remove(dst)) != 0)
+					break;
+				exists = false;
+			}
+			error = rebase_symlink(ent->fts_accpath, dst,
+			    ent->fts_statp, exists ? &dsb : NULL);
+			break;
+		case FTS_DNR:
+		case FTS_ERR:
+		case FTS_NS:
+			error = ent->fts_errno;
+			break;
+		default:
+			/* FTS_DP, and special files a world has no use for */
+			break;
+		}
+		if (error != 0)
+			strlcpy(rb->failed, dst, sizeof(rb->failed));
+	}
+
+	fts_close(fts);
+	return (error);
+}
+
+/* further names of hard links, once the first name is in place */
+static int
+rebase_links(struct rebase *rb)
+{
+	size_t i;
+	struct stat sb, dsb;
+	struct rebase_entry *re;
+	char dst[MAXPATHLEN], first[MAXPATHLEN];
+	int error;
+
+	for (i = 0; i < rb->links.count; i++) {
+		re = &rb->links.v[i];
+		snprintf(dst, sizeof(dst), "%s%s", rb->dst, re->path);
+		snprintf(first, sizeof(first), "%s%s", rb->dst, re->target);
+
+		if (lstat(first, &sb) != 0)
+			return (errno);
+		if (lstat(dst, &dsb) == 0) {
+			if (dsb.st_ino == sb.st_ino)
+				continue;
+			if (dsb.st_flags != 0)
+				lchflags(dst, 0);
+			if (unlink(dst) != 0)
+				return (errno);
+		}
+
+		/* immutable files cannot be linked to */
+		if (sb.st_flags != 0)
+			lchflags(first, 0);
+		error = link(first, dst) != 0 ? errno : 0;
+		if (sb.st_flags != 0)
+			lchflags(first, sb.st_flags);
+		if (error != 0) {
+			strlcpy(rb->failed, dst, sizeof(rb->failed));
+			return (error);
+		}
+	}
+
+	return (0);
+}
+
+/* make the tree at dst the same as the one at src */
+static int
+rebase_tree(libjectl_handle_t *hdl, struct rebase *rb)
+{
+	int i, nthreads, error;
+	size_t j;
+	struct stat dsb;
+	char dst[MAXPATHLEN];
+	pthread_t tids[REBASE_MAXTHREADS];
+
+	if ((error = rebase_prune(rb)) != 0)
+		return (je_error(hdl, JE_ERR_IO, "cannot prune '%s': %s",
+		    rb->dst, strerror(error)));
+	if ((error = rebase_walk(rb)) != 0)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", rb->failed,
+		    strerror(error)));
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > REBASE_MAXTHREADS)
+		nthreads = REBASE_MAXTHREADS;
+
+	pthread_mutex_init(&rb->lock, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, rebase_thread, rb) != 0)
+			break;
+	}
+	nthreads = i;
+	/* no thread to spare, do it ourselves */
+	if (nthreads == 0)
+		rebase_thread(rb);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&rb->lock);
+
+	if (rb->error != 0)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", rb->failed,
+		    strerror(rb->error)));
+
+	if ((error = rebase_links(rb)) != 0)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", rb->failed,
+		    strerror(error)));
+
+	/* directories last, deepest first, filling them may need write access */
+	for (j = rb->dirs.count; j-- > 0;) {
+		snprintf(dst, sizeof(dst), "%s%s", rb->dst, rb->dirs.v[j].path);
+		if (lstat(dst, &dsb) == 0)
+			rebase_attrs(dst, &rb->dirs.v[j].sb, &dsb);
+	}
+
+	return (0);
+}
+
+static int
+count_cb(zfs_handle_t *zhp, void *arg)
+{
+	(*(int *)arg)++;
+	zfs_close(zhp);
+	return (0);
+}
+
+/*
+ * How close candidate is to zhp: the je:poudriere properties that match,
+ * then the distance between their FreeBSD versions.
+ */
+static void
+rebase_score(zfs_handle_t *zhp, zfs_handle_t *candidate, int *match,
+    unsigned long *distance)
+{
+	static const char *props[] = {
+		"je:poudriere:jailname",
+		"je:poudriere:overlaydir",
+		"je:poudriere:packagelist",
+		"je:version",
+	};
+	size_t i;
+	char *a, *b;
+	unsigned long va, vb;
+
+	*match = 0;
+	for (i = 0; i < nitems(props); i++) {
+		if (get_property(zhp, props[i], &a) == 0 &&
+		    get_property(candidate, props[i], &b) == 0 &&
+		    strcmp(a, b) == 0)
+			(*match)++;
+	}
+
+	*distance = ULONG_MAX;
+	if (get_property(zhp, "je:poudriere:freebsd_version", &a) == 0 &&
+	    get_property(candidate, "je:poudriere:freebsd_version", &b) == 0) {
+		va = strtoul(a, NULL, 10);
+		vb = strtoul(b, NULL, 10);
+		*distance = va > vb ? va - vb : vb - va;
+	}
+}
+
+struct closest_info {
+	zfs_handle_t *zhp;
+	zfs_handle_t *best;
+	int match;
+	unsigned long distance;
+};
+
+static int
+closest_cb(zfs_handle_t *candidate, void *arg)
+{
+	struct closest_info *ci = arg;
+	int match;
+	unsigned long distance;
+
+	/* itself, or one that cannot be cloned next to it */
+	if (strcmp(zfs_get_name(candidate), zfs_get_name(ci->zhp)) == 0 ||
+	    strcmp(zfs_get_pool_name(candidate), zfs_get_pool_name(ci->zhp)) != 0) {
+		zfs_close(candidate);
+		return (0);
+	}
+
+	rebase_score(ci->zhp, candidate, &match, &distance);
+	if (ci->best == NULL || match > ci->match ||
+	    (match == ci->match && distance < ci->distance)) {
+		if (ci->best != NULL)
+			zfs_close(ci->best);
+		ci->best = candidate;
+		ci->match = match;
+		ci->distance = distance;
+	} else
+		zfs_close(candidate);
+
+	return (0);
+}
+
+/* the jail environment in the jepools most like zhp, NULL if none */
+static zfs_handle_t *
+rebase_closest(libjectl_handle_t *hdl, zfs_handle_t *zhp)
+{
+	int i;
+	zfs_handle_t *root;
+	struct closest_info ci = { zhp, NULL, 0, 0 };
+
+	for (i = 0; i < hdl->njepools; i++) {
+		if ((root = zfs_open(hdl->lzh, hdl->jepools[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(root, closest_cb, &ci);
+		zfs_close(root);
+	}
+
+	return (ci.best);
+}
+
+/* mount src and dst below a new temporary directory */
+static int
+rebase_mount(libjectl_handle_t *hdl, zfs_handle_t *src, zfs_handle_t *dst,
+    char *tmp, char *srcdir, char *dstdir)
+{
+	strlcpy(tmp, "/tmp/jectl.rebase.XXXXXX", MAXPATHLEN);
+	if (mkdtemp(tmp) == NULL)
+		return (je_error(hdl, JE_ERR_IO, "mkdtemp: %s", strerror(errno)));
+
+	snprintf(srcdir, MAXPATHLEN, "%s/src", tmp);
+	snprintf(dstdir, MAXPATHLEN, "%s/dst", tmp);
+	if (mkdir(srcdir, 0700) != 0 || mkdir(dstdir, 0700) != 0)
+		return (je_error(hdl, JE_ERR_IO, "mkdir: %s", strerror(errno)));
+
+	if (zfs_mount_at(src, "ro", 0, srcdir) != 0)
+		return (je_error(hdl, JE_ERR_MOUNT, "cannot mount '%s' at '%s'",
+		    zfs_get_name(src), srcdir));
+	if (zfs_mount_at(dst, NULL, 0, dstdir) != 0)
+		return (je_error(hdl, JE_ERR_MOUNT, "cannot mount '%s' at '%s'",
+		    zfs_get_name(dst), dstdir));
+
+	return (0);
+}
+
+static void
+rebase_unmount(zfs_handle_t *src, zfs_handle_t *dst, const char *tmp,
+    const char *srcdir, const char *dstdir)
+{
+	zfs_unmount(dst, dstdir, 0);
+	zfs_unmount(src, srcdir, 0);
+	rmdir(dstdir);
+	rmdir(srcdir);
+	rmdir(tmp);
+}
+
+static int
+last_snapshot_cb(zfs_handle_t *zhp, void *arg)
+{
+	zfs_handle_t **last = arg;
+
+	if (*last != NULL)
+		zfs_close(*last);
+	*last = zhp;
+	return (0);
+}
+
+/*
+ * Destroying the received copy takes the snapshot of the stream, whose
+ * guid import looks for to find a stream imported before. Take one of
+ * the same name on the clone and record that guid on it.
+ */
+static int
+rebase_snapshot(libjectl_handle_t *hdl, zfs_handle_t *zhp,
+    const char *clonename)
+{
+	int error;
+	nvlist_t *props;
+	zfs_handle_t *last;
+	char guid[32];
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+
+	last = NULL;
+	zfs_iter_snapshots_sorted(zhp, last_snapshot_cb, &last, 0, 0);
+	if (last == NULL)
+		return (0);
+
+	snprintf(guid, sizeof(guid), "%ju",
+	    (uintmax_t)zfs_prop_get_int(last, ZFS_PROP_GUID));
+	snprintf(name, sizeof(name), "%s%s", clonename,
+	    strchr(zfs_get_name(last), '@'));
+	zfs_close(last);
+
+	if (nvlist_alloc(&props, NV_UNIQUE_NAME, 0) != 0)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+	nvlist_add_string(props, JE_GUID_PROP, guid);
+	error = zfs_snapshot(hdl->lzh, name, B_FALSE, props);
+	nvlist_free(props);
+
+	if (error != 0)
+		return (je_error(hdl, JE_ERR_ZFSCLONE, "cannot snapshot '%s'",
+		    name));
+
+	return (0);
+}
+
+/*
+ * Rebase the jail environment just received as name. Without anything
+ * to rebase onto, it stays the full copy it was received as. So does
+ * a world variants are sent from (je:poudriere:variants): they are
+ * received as clones of its very snapshot, by guid.
+ */
+int
+je_rebase(libjectl_handle_t *hdl, const char *name)
+{
+	int error, children;
+	nvlist_t *props;
+	zfs_handle_t *zhp, *base, *clone;
+	struct rebase rb;
+	struct renameflags flags = { 0 };
+	char clonename[ZFS_MAX_DATASET_NAME_LEN];
+	char tmp[MAXPATHLEN], srcdir[MAXPATHLEN], dstdir[MAXPATHLEN];
+	char shared[32], written[32];
+	char *variants;
+	uint64_t start;
+
+	if ((zhp = zfs_open(hdl->lzh, name, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return (je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", name));
+
+	if (get_property(zhp, "je:poudriere:variants", &variants) == 0) {
+		je_info(hdl, "'%s' is the origin of variants (%s), not rebased",
+		    name, variants);
+		zfs_close(zhp);
+		return (0);
+	}
+
+	children = 0;
+	zfs_iter_filesystems(zhp, count_cb, &children);
+	if (children != 0) {
+		je_info(hdl, "'%s' has descendants, not rebased", name);
+		zfs_close(zhp);
+		return (0);
+	}
+
+	if ((base = rebase_closest(hdl, zhp)) == NULL) {
+		je_info(hdl, "nothing to rebase '%s' onto", name);
+		zfs_close(zhp);
+		return (0);
+	}
+
+	start = je_now_ns();
+	snprintf(clonename, sizeof(clonename), "%s.rebase", name);
+	if ((clone = je_copy_impl(hdl, base, clonename)) == NULL) {
+		zfs_close(base);
+		zfs_close(zhp);
+		return (hdl->error);
+	}
+
+	/* the clone is the received jail environment from now on */
+	if ((props = je_user_props(zhp)) == NULL) {
+		error = je_error(hdl, JE_ERR_NOMEM, "out of memory");
+		goto fail;
+	}
+	error = zfs_prop_set_list(clone, props);
+	nvlist_free(props);
+	if (error != 0) {
+		error = je_error(hdl, JE_ERR_ZFSPROP,
+		    "cannot set properties on '%s'", clonename);
+		goto fail;
+	}
+
+	memset(&rb, 0, sizeof(rb));
+	rb.src = srcdir;
+	rb.dst = dstdir;
+	if ((error = rebase_mount(hdl, zhp, clone, tmp, srcdir, dstdir)) == 0)
+		error = rebase_tree(hdl, &rb);
+	rebase_unmount(zhp, clone, tmp, srcdir, dstdir);
+	rebase_list_free(&rb.files);
+	rebase_list_free(&rb.dirs);
+	rebase_list_free(&rb.links);
+	rebase_list_free(&rb.inodes);
+	if (error != 0)
+		goto fail;
+
+	if ((error = rebase_snapshot(hdl, zhp, clonename)) != 0)
+		goto fail;
+
+	if (je_destroy(zhp) != 0) {
+		error = je_error(hdl, JE_ERR_UNKNOWN, "cannot destroy '%s'", name);
+		goto fail;
+	}
+	if (zfs_rename(clone, name, flags) != 0) {
+		zfs_close(clone);
+		zfs_close(base);
+		zfs_close(zhp);
+		return (je_error(hdl, JE_ERR_ZFSRENAME,
+		    "cannot rename '%s' to '%s'", clonename, name));
+	}
+
+	je_metrics_sample(name, "import", "rebase", je_now_ns() - start,
+	    rb.written);
+
+	zfs_nicenum(rb.shared, shared, sizeof(shared));
+	zfs_nicenum(rb.written, written, sizeof(written));
+	je_info(hdl, "'%s' rebased onto '%s': %s shared, %s written", name,
+	    zfs_get_name(base), shared, written);
+
+	zfs_close(clone);
+	zfs_close(base);
+	zfs_close(zhp);
+	return (0);
+
+fail:
+	/* keep the full copy */
+	je_destroy(clone);
+	zfs_close(clone);
+	zfs_close(base);
+	zfs_close(zhp);
+	return (error);
+}
@@ -0,0 +1,301 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <time.h>
+#include <libzfs_core.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Snapshot the persistent datasets of jails: the descendants of the
+ * active jail environment, config among them, and the datasets kept
+ * beside the jail environments. The jail environment itself is not
+ * snapshotted, it is the same as its source in the jepool.
+ *
+ * All snapshots of a pool are taken with one lzc_snapshot(), in a single
+ * txg, so they are consistent with each other. They are named
+ * jectl-<UTC time>-<active jail environment>; properties given to
+ * lzc_snapshot() apply to the whole batch, so the name carries the tag.
+ * The time goes down to the nanosecond, runs in the same second do not
+ * clash, and has a fixed width, so names sort like their creation.
+ */
+#define	SNAP_PREFIX	"jectl-"
+
+struct snap_pool {
+	char pool[ZFS_MAX_DATASET_NAME_LEN];
+	nvlist_t *snaps;
+	nvlist_t *destroy;
+};
+
+struct snap_info {
+	libjectl_handle_t *hdl;
+	char stamp[32];
+	/* jails live under the jeroots, in JE_MAXROOTS pools at most */
+	struct snap_pool pools[JE_MAXROOTS];
+	int npools;
+	int error;		/* first failure while walking all jails */
+};
+
+static struct snap_pool *
+snap_pool(struct snap_info *si, const char *pool)
+{
+	int i;
+	struct snap_pool *sp;
+
+	for (i = 0; i < si->npools; i++) {
+		if (strcmp(si->pools[i].pool, pool) == 0)
+			return (&si->pools[i]);
+	}
+	if (si->npools == JE_MAXROOTS)
+		return (NULL);
+
+	sp = &si->pools[si->npools];
+	if (nvlist_alloc(&sp->snaps, NV_UNIQUE_NAME, 0) != 0)
+		return (NULL);
+	if (nvlist_alloc(&sp->destroy, NV_UNIQUE_NAME, 0) != 0) {
+		nvlist_free(sp->snaps);
+		return (NULL);
+	}
+	strlcpy(sp->pool, pool, sizeof(sp->pool));
+	si->npools++;
+
+	return (sp);
+}
+
+/*
+ * add the persistent datasets of jds, with je active, to the batch of
+ * its pool
+ */
+static int
+snap_jail(struct snap_info *si, zfs_handle_t *jds, zfs_handle_t *je)
+{
+	int error;
+	size_t i;
+	struct snap_pool *sp;
+	get_all_cb_t cb = { 0 };
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+
+	if ((sp = snap_pool(si, zfs_get_pool_name(jds))) == NULL)
+		return (je_error(si->hdl, JE_ERR_NOMEM, "out of memory"));
+
+	je_gather(je, &cb);
+	je_gather_persistent(jds, &cb);
+
+	error = 0;
+	for (i = 1; i < cb.cb_used; i++) {
+		if (snprintf(name, sizeof(name), "%s@" SNAP_PREFIX "%s-%s",
+		    zfs_get_name(cb.cb_handles[i]), si->stamp,
+		    strrchr(zfs_get_name(je), '/') + 1) >= (int)sizeof(name)) {
+			error = je_error(si->hdl, JE_ERR_INVALIDARG,
+			    "snapshot name too long for '%s'",
+			    zfs_get_name(cb.cb_handles[i]));
+			break;
+		}
+		nvlist_add_boolean(sp->snaps, name);
+	}
+
+	je_gather_free(&cb);
+	return (error);
+}
+
+static int
+snap_jail_cb(zfs_handle_t *jds, void *arg)
+{
+	struct snap_info *si = arg;
+	int error;
+	zfs_handle_t *je;
+
+	/* not a jail dataset, e.g. the warm pool */
+	if ((je = get_active_je(si->hdl, jds)) != NULL) {
+		error = snap_jail(si, jds, je);
+		if (si->error == 0)
+			si->error = error;
+		zfs_close(je);
+	}
+
+	zfs_close(jds);
+	return (0);
+}
+
+static int
+snap_retain_cb(zfs_handle_t *zhp, void *arg)
+{
+	if (strncmp(strchr(zfs_get_name(zhp), '@') + 1, SNAP_PREFIX,
+	    strlen(SNAP_PREFIX)) == 0)
+		libzfs_add_handle(arg, zhp);
+	else
+		zfs_close(zhp);
+
+	return (0);
+}
+
+/* queue all but the keep newest jectl- snapshots of dataset for destroy */
+static void
+snap_retain(struct snap_info *si, struct snap_pool *sp, const char *dataset,
+    int keep)
+{
+	size_t i;
+	zfs_handle_t *zhp;
+	get_all_cb_t cb = { 0 };
+
+	if ((zhp = zfs_open(si->hdl->lzh, dataset, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return;
+
+	/* oldest first */
+	zfs_iter_snapshots_sorted(zhp, snap_retain_cb, &cb, 0, 0);
+	for (i = 0; i + keep < cb.cb_used; i++)
+		nvlist_add_boolean(sp->destroy, zfs_get_name(cb.cb_handles[i]));
+
+	je_gather_free(&cb);
+	zfs_close(zhp);
+}
+
+/* first failure of a batch, lzc_*() report them per snapshot */
+static int
+snap_failed(libjectl_handle_t *hdl, const char *what, int error,
+    nvlist_t *errlist)
+{
+	nvpair_t *nvp;
+	int32_t err;
+
+	if (errlist != NULL &&
+	    (nvp = nvlist_next_nvpair(errlist, NULL)) != NULL &&
+	    nvpair_value_int32(nvp, &err) == 0)
+		error = je_error(hdl, JE_ERR_ZFSCLONE, "cannot %s '%s': %s",
+		    what, nvpair_name(nvp), strerror(err));
+	else
+		error = je_error(hdl, JE_ERR_ZFSCLONE, "cannot %s: %s", what,
+		    strerror(error));
+
+	nvlist_free(errlist);
+	return (error);
+}
+
+static int
+snap_pool_take(struct snap_info *si, struct snap_pool *sp, int keep)
+{
+	int error;
+	nvpair_t *nvp;
+	nvlist_t *errlist;
+	char dataset[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t start;
+
+	if (nvlist_empty(sp->snaps))
+		return (0);
+
+	start = je_now_ns();
+	errlist = NULL;
+	if ((error = lzc_snapshot(sp->snaps, NULL, &errlist)) != 0)
+		return (snap_failed(si->hdl, "snapshot", error, errlist));
+	nvlist_free(errlist);
+	je_metrics_sample(sp->pool, "snapshot", "snapshot",
+	    je_now_ns() - start, 0);
+	je_info(si->hdl, "%s: snapshot %s of the persistent datasets",
+	    sp->pool, si->stamp);
+
+	if (keep <= 0)
+		return (0);
+
+	for (nvp = nvlist_next_nvpair(sp->snaps, NULL); nvp != NULL;
+	    nvp = nvlist_next_nvpair(sp->snaps, nvp)) {
+		strlcpy(dataset, nvpair_name(nvp), sizeof(dataset));
+		*strchr(dataset, '@') = '\0';
+		snap_retain(si, sp, dataset, keep);
+	}
+
+	if (nvlist_empty(sp->destroy))
+		return (0);
+
+	start = je_now_ns();
+	errlist = NULL;
+	if ((error = lzc_destroy_snaps(sp->destroy, B_FALSE, &errlist)) != 0)
+		return (snap_failed(si->hdl, "destroy", error, errlist));
+	nvlist_free(errlist);
+	je_metrics_sample(sp->pool, "snapshot", "destroy",
+	    je_now_ns() - start, 0);
+
+	return (0);
+}
+
+/*
+ * Snapshot the persistent datasets of the count jails given, of every
+ * jail when count is 0, and keep only the keep newest jectl- snapshots
+ * of each; keep 0 keeps them all.
+ */
+int
+je_snapshot(libjectl_handle_t *hdl, char * const *jails, int count, int keep)
+{
+	int i, error;
+	struct timespec now;
+	struct snap_info si;
+	char stamp[24];
+	zfs_handle_t *zhp, *je;
+
+	memset(&si, 0, sizeof(si));
+	si.hdl = hdl;
+	clock_gettime(CLOCK_REALTIME, &now);
+	strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", gmtime(&now.tv_sec));
+	snprintf(si.stamp, sizeof(si.stamp), "%s.%09ldZ", stamp, now.tv_nsec);
+
+	error = 0;
+	if (count == 0) {
+		for (i = 0; i < hdl->njeroots; i++) {
+			if ((zhp = zfs_open(hdl->lzh, hdl->jeroots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+				continue;
+			zfs_iter_filesystems(zhp, snap_jail_cb, &si);
+			zfs_close(zhp);
+		}
+		error = si.error;
+	} else {
+		for (i = 0; i < count && error == 0; i++) {
+			if ((zhp = get_jail_dataset(hdl, jails[i])) == NULL) {
+				error = hdl->error;
+				break;
+			}
+			if ((je = get_active_je(hdl, zhp)) == NULL) {
+				error = je_error(hdl, JE_ERR_NOACTIVE,
+				    "cannot find active jail environment for '%s'",
+				    zfs_get_name(zhp));
+				zfs_close(zhp);
+				break;
+			}
+			error = snap_jail(&si, zhp, je);
+			zfs_close(je);
+			zfs_close(zhp);
+		}
+	}
+
+	for (i = 0; i < si.npools; i++) {
+		if (error == 0)
+			error = snap_pool_take(&si, &si.pools[i], keep);
+		nvlist_free(si.pools[i].snaps);
+		nvlist_free(si.pools[i].destroy);
+	}
+
+	return (error);
+}
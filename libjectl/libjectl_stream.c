@@ -0,0 +1,579 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * A send stream starts with a BEGIN record. For replication streams
+ * (zfs send -R/-p) the BEGIN record carries a packed nvlist describing
+ * every dataset in the stream, including its locally set properties.
+ * Reading it up front tells jectl where a stream has to go before any
+ * data is written; the consumed bytes are replayed to zfs_receive
+ * through a pipe.
+ */
+
+#define	STREAM_BUFSIZE	(1024 * 1024)
+
+static int
+read_all(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+	char *p;
+
+	p = buf;
+	while (len > 0) {
+		if ((n = read(fd, p, len)) <= 0)
+			return (1);
+		p += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+	const char *p;
+
+	p = buf;
+	while (len > 0) {
+		if ((n = write(fd, p, len)) <= 0)
+			return (1);
+		p += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+/*
+ * find the top-level dataset of a replication stream in the "fss" list
+ */
+static nvlist_t *
+stream_top_fs(nvlist_t *payload, const char *fsname)
+{
+	nvpair_t *nvp;
+	nvlist_t *fss, *fs;
+	char *name;
+
+	if (nvlist_lookup_nvlist(payload, "fss", &fss) != 0)
+		return (NULL);
+
+	nvp = NULL;
+	while ((nvp = nvlist_next_nvpair(fss, nvp)) != NULL) {
+		if (nvpair_value_nvlist(nvp, &fs) != 0)
+			continue;
+		if (nvlist_lookup_string(fs, "name", &name) == 0 &&
+		    strcmp(name, fsname) == 0)
+			return (fs);
+	}
+
+	return (NULL);
+}
+
+static void
+stream_parse_payload(struct je_stream *js)
+{
+	nvlist_t *fs, *snaps;
+	char fsname[ZFS_MAX_DATASET_NAME_LEN];
+	char *snap;
+
+	strlcpy(fsname, js->toname, sizeof(fsname));
+	if ((snap = strchr(fsname, '@')) == NULL)
+		return;
+	*snap++ = '\0';
+
+	if ((fs = stream_top_fs(js->payload, fsname)) == NULL)
+		return;
+
+	nvlist_lookup_nvlist(fs, "props", &js->props);
+
+	if (nvlist_lookup_nvlist(fs, "snaps", &snaps) != 0)
+		return;
+
+	nvlist_lookup_uint64(snaps, snap, &js->toguid);
+}
+
+/*
+ * take the guids and the clone flag from a BEGIN record, false if drr
+ * is not one.
+ */
+static bool
+stream_begin(struct je_stream *js, const dmu_replay_record_t *drr)
+{
+	const struct drr_begin *drrb;
+	uint32_t flags;
+	bool swap;
+
+	drrb = &drr->drr_u.drr_begin;
+	swap = drrb->drr_magic == BSWAP_64(DMU_BACKUP_MAGIC);
+	if ((swap ? BSWAP_32(drr->drr_type) : drr->drr_type) != DRR_BEGIN ||
+	    (!swap && drrb->drr_magic != DMU_BACKUP_MAGIC))
+		return (false);
+
+	if (js->toguid == 0)
+		js->toguid = swap ? BSWAP_64(drrb->drr_toguid) : drrb->drr_toguid;
+	js->fromguid = swap ? BSWAP_64(drrb->drr_fromguid) :
+	    drrb->drr_fromguid;
+	flags = swap ? BSWAP_32(drrb->drr_flags) : drrb->drr_flags;
+	js->clone = (flags & DRR_FLAG_CLONE) != 0;
+
+	return (true);
+}
+
+/*
+ * The guids in the BEGIN record of a compound stream are zero. Those of
+ * the top-level dataset are in the BEGIN record of its own stream, right
+ * after the END record that closes the payload. A stream sent from the
+ * origin of a clone (zfs send -i origin clone@snap) has no fromsnap in
+ * its payload, this is the only place that names the origin.
+ */
+static int
+stream_read_begin(libjectl_handle_t *hdl, struct je_stream *js)
+{
+	dmu_replay_record_t drr;
+	size_t off;
+
+	off = js->hdrlen;
+	if ((js->header = reallocf(js->header, off + 2 * sizeof(drr))) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	if (read_all(js->fd, js->header + off, 2 * sizeof(drr)) != 0)
+		return (je_error(hdl, JE_ERR_STREAM, "cannot read stream header"));
+	js->hdrlen += 2 * sizeof(drr);
+
+	/* the payload leaves it unaligned */
+	memcpy(&drr, js->header + off + sizeof(drr), sizeof(drr));
+	stream_begin(js, &drr);
+
+	return (0);
+}
+
+/*
+ * read and parse the BEGIN record, and the payload of a replication
+ * stream, from fd.
+ */
+int
+je_stream_open(libjectl_handle_t *hdl, struct je_stream *js, int fd)
+{
+	struct stat sb;
+	dmu_replay_record_t *drr;
+	struct drr_begin *drrb;
+	uint64_t versioninfo;
+	uint32_t payloadlen;
+	bool swap;
+
+	memset(js, 0, sizeof(*js));
+	js->fd = fd;
+	js->size = -1;
+
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode))
+		js->size = sb.st_size;
+
+	if ((js->header = malloc(sizeof(*drr))) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	if (read_all(fd, js->header, sizeof(*drr)) != 0)
+		return (je_error(hdl, JE_ERR_STREAM, "cannot read stream header"));
+	js->hdrlen = sizeof(*drr);
+
+	drr = (dmu_replay_record_t *)js->header;
+	drrb = &drr->drr_u.drr_begin;
+
+	if (!stream_begin(js, drr)) {
+		return (je_error(hdl, JE_ERR_STREAM,
+		    "invalid stream (bad magic number)"));
+	}
+
+	swap = drrb->drr_magic == BSWAP_64(DMU_BACKUP_MAGIC);
+	versioninfo = swap ? BSWAP_64(drrb->drr_versioninfo) : drrb->drr_versioninfo;
+	payloadlen = swap ? BSWAP_32(drr->drr_payloadlen) : drr->drr_payloadlen;
+	strlcpy(js->toname, drrb->drr_toname, sizeof(js->toname));
+
+	if (DMU_GET_STREAM_HDRTYPE(versioninfo) != DMU_COMPOUNDSTREAM ||
+	    payloadlen == 0)
+		return (0);
+
+	/* the guids of a compound stream are those of the top-level dataset */
+	js->toguid = 0;
+	js->fromguid = 0;
+	js->clone = false;
+
+	if ((js->header = reallocf(js->header, js->hdrlen + payloadlen)) == NULL)
+		return (je_error(hdl, JE_ERR_NOMEM, "out of memory"));
+
+	if (read_all(fd, js->header + js->hdrlen, payloadlen) != 0)
+		return (je_error(hdl, JE_ERR_STREAM, "cannot read stream header"));
+
+	if (nvlist_unpack(js->header + js->hdrlen, payloadlen, &js->payload, 0) != 0)
+		return (je_error(hdl, JE_ERR_STREAM,
+		    "invalid stream (bad header payload)"));
+	js->hdrlen += payloadlen;
+
+	stream_parse_payload(js);
+
+	return (stream_read_begin(hdl, js));
+}
+
+void
+je_stream_close(struct je_stream *js)
+{
+	if (js->payload != NULL)
+		nvlist_free(js->payload);
+	free(js->header);
+	js->payload = NULL;
+	js->props = NULL;
+	js->header = NULL;
+}
+
+/*
+ * look up a property of the top-level dataset in the stream
+ */
+int
+je_stream_prop(struct je_stream *js, const char *property, char **val)
+{
+	if (js->props == NULL)
+		return (1);
+
+	if (nvlist_lookup_string(js->props, property, val) != 0)
+		return (1);
+
+	/* user property has been "unset" */
+	if (strcmp(*val, "") == 0)
+		return (1);
+
+	return (0);
+}
+
+/*
+ * Is there room for the stream below root. Neither the BEGIN record nor
+ * the replication payload carry the size of the stream, so it is only
+ * known for regular files; for a pipe the check is skipped with a warning.
+ */
+bool
+je_stream_fits(libjectl_handle_t *hdl, struct je_stream *js, const char *root)
+{
+	uint64_t avail;
+	zfs_handle_t *zhp;
+
+	if (js->size < 0) {
+		je_warn(hdl, "stream size unknown, free space in '%s' not "
+		    "checked; import from a file to check it", root);
+		return (true);
+	}
+
+	if ((zhp = zfs_open(hdl->lzh, root, ZFS_TYPE_FILESYSTEM)) == NULL)
+		return (false);
+
+	avail = zfs_prop_get_int(zhp, ZFS_PROP_AVAILABLE);
+	zfs_close(zhp);
+
+	return ((uint64_t)js->size <= avail);
+}
+
+struct pump_args {
+	struct je_stream *js;
+	int fd;
+	int error;
+	const char *pool;
+};
+
+/*
+ * Throttling state. rate is the current limit in bytes per second, zero
+ * for none. In adaptive mode the limit follows the average I/O latency
+ * of the destination pool: halved whenever the latency is above target,
+ * raised by an eighth while it is below, never above the configured
+ * limit and never below THROTTLE_MINRATE.
+ */
+#define	THROTTLE_MINRATE	(1024 * 1024)
+#define	THROTTLE_INTERVAL	500000000ULL	/* sample every 500ms */
+#define	THROTTLE_MAXBUCKETS	64
+
+struct throttle {
+	uint64_t rate;
+	uint64_t start;		/* beginning of the current period */
+	uint64_t sent;		/* bytes sent during the current period */
+	uint64_t sample;	/* time of the last latency sample */
+	uint64_t sample_bytes;
+	libzfs_handle_t *hdl;
+	zpool_handle_t *zhp;
+	uint64_t histo[THROTTLE_MAXBUCKETS];
+};
+
+/*
+ * Average latency, in nanoseconds, of the pool's I/O completed since the
+ * previous call. Computed from the total read and write latency
+ * histograms of the root vdev, bucket i counts I/Os of [2^i, 2^(i+1)) ns.
+ * Returns zero when there was no I/O or no statistics are available.
+ */
+static uint64_t
+pool_latency(struct throttle *th)
+{
+	unsigned int i, c, r;
+	boolean_t missing;
+	nvlist_t *config, *nvroot, *nvx;
+	uint64_t *histo, cur[THROTTLE_MAXBUCKETS] = { 0 };
+	uint64_t ios, total, delta;
+	const char *names[] = {
+		ZPOOL_CONFIG_VDEV_TOT_R_LAT_HISTO,
+		ZPOOL_CONFIG_VDEV_TOT_W_LAT_HISTO,
+	};
+
+	if (zpool_refresh_stats(th->zhp, &missing) != 0 || missing)
+		return (0);
+
+	config = zpool_get_config(th->zhp, NULL);
+	if (nvlist_lookup_nvlist(config, ZPOOL_CONFIG_VDEV_TREE, &nvroot) != 0 ||
+	    nvlist_lookup_nvlist(nvroot, ZPOOL_CONFIG_VDEV_STATS_EX, &nvx) != 0)
+		return (0);
+
+	for (r = 0; r < nitems(names); r++) {
+		if (nvlist_lookup_uint64_array(nvx, names[r], &histo, &c) != 0)
+			return (0);
+		for (i = 0; i < c && i < THROTTLE_MAXBUCKETS; i++)
+			cur[i] += histo[i];
+	}
+
+	ios = total = 0;
+	for (i = 0; i < THROTTLE_MAXBUCKETS; i++) {
+		delta = cur[i] - th->histo[i];
+		th->histo[i] = cur[i];
+		ios += delta;
+		/* middle of the bucket */
+		total += delta * ((1ULL << i) + (1ULL << i) / 2);
+	}
+
+	return (ios == 0 ? 0 : total / ios);
+}
+
+static void
+throttle_init(struct throttle *th, struct je_stream *js, const char *pool)
+{
+	memset(th, 0, sizeof(*th));
+	th->rate = js->rate;
+	th->start = th->sample = je_now_ns();
+
+	if (js->latency == 0)
+		return;
+
+	if ((th->hdl = libzfs_init()) == NULL)
+		return;
+	if ((th->zhp = zpool_open(th->hdl, pool)) == NULL) {
+		libzfs_fini(th->hdl);
+		th->hdl = NULL;
+		return;
+	}
+
+	/* prime the histograms */
+	pool_latency(th);
+}
+
+static void
+throttle_fini(struct throttle *th)
+{
+	if (th->zhp != NULL)
+		zpool_close(th->zhp);
+	if (th->hdl != NULL)
+		libzfs_fini(th->hdl);
+}
+
+static void
+throttle_adapt(struct throttle *th, struct je_stream *js, uint64_t now)
+{
+	uint64_t latency, rate;
+
+	if (th->zhp == NULL || now - th->sample < THROTTLE_INTERVAL)
+		return;
+
+	latency = pool_latency(th);
+	if (latency > js->latency) {
+		/* unthrottled so far, start from what we achieved */
+		if (th->rate == 0)
+			th->rate = th->sample_bytes * 1000000000ULL /
+			    (now - th->sample);
+		rate = th->rate / 2;
+	} else if (th->rate != 0) {
+		rate = th->rate + th->rate / 8;
+		/* back to unthrottled, unless a limit was given */
+		if (js->rate == 0 && rate > th->sample_bytes * 4000000000ULL /
+		    (now - th->sample))
+			rate = 0;
+		else if (js->rate != 0 && rate > js->rate)
+			rate = js->rate;
+	} else
+		rate = 0;
+
+	if (rate != 0 && rate < THROTTLE_MINRATE)
+		rate = THROTTLE_MINRATE;
+
+	if (rate != th->rate) {
+		th->rate = rate;
+		th->start = now;
+		th->sent = 0;
+	}
+
+	th->sample = now;
+	th->sample_bytes = 0;
+}
+
+/*
+ * account for len bytes sent, sleep for as long as we are ahead of the
+ * current rate.
+ */
+static void
+throttle(struct throttle *th, struct je_stream *js, size_t len)
+{
+	uint64_t now, due;
+	struct timespec ts;
+
+	th->sent += len;
+	th->sample_bytes += len;
+
+	now = je_now_ns();
+	throttle_adapt(th, js, now);
+
+	if (th->rate == 0)
+		return;
+
+	due = th->start + th->sent * 1000000000ULL / th->rate;
+	if (due <= now)
+		return;
+
+	ts.tv_sec = (due - now) / 1000000000ULL;
+	ts.tv_nsec = (due - now) % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * replay the consumed header, then copy the rest of the stream
+ */
+static void *
+pump_thread(void *arg)
+{
+	ssize_t n;
+	sigset_t set;
+	size_t chunk;
+	struct pump_args *pa;
+	struct je_stream *js;
+	struct throttle th;
+	char *buf;
+
+	pa = arg;
+	js = pa->js;
+	pa->error = 1;
+
+	throttle_init(&th, js, pa->pool);
+
+	/* smaller writes keep a throttled stream smooth */
+	chunk = STREAM_BUFSIZE;
+	if (js->latency != 0)
+		chunk = STREAM_BUFSIZE / 4;
+	if (js->rate != 0 && js->rate / 10 < chunk)
+		chunk = MAX(js->rate / 10, 64 * 1024);
+
+	/* a failed receive closes the pipe, take EPIPE over SIGPIPE */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	if ((buf = malloc(STREAM_BUFSIZE)) == NULL)
+		goto out;
+
+	if (write_all(pa->fd, js->header, js->hdrlen) != 0)
+		goto out;
+	js->bytes = js->hdrlen;
+
+	while ((n = read(js->fd, buf, chunk)) > 0) {
+		if (write_all(pa->fd, buf, n) != 0)
+			goto out;
+		js->bytes += n;
+		if (js->rate != 0 || js->latency != 0)
+			throttle(&th, js, n);
+	}
+
+	if (n == 0)
+		pa->error = 0;
+out:
+	throttle_fini(&th);
+	free(buf);
+	close(pa->fd);
+	return (NULL);
+}
+
+/*
+ * zfs receive the stream into name, props are passed to zfs_receive as
+ * overrides (string values, zfs recv -o) and excludes (booleans, zfs
+ * recv -x).
+ */
+int
+je_stream_receive(libjectl_handle_t *hdl, struct je_stream *js,
+    const char *name, nvlist_t *props)
+{
+	int error, fds[2];
+	pthread_t tid;
+	struct pump_args pa;
+	recvflags_t flags = { .nomount = 1 };
+	char pool[ZFS_MAX_DATASET_NAME_LEN];
+
+	if (pipe(fds) != 0)
+		return (je_error(hdl, JE_ERR_IO, "pipe: %s", strerror(errno)));
+
+	/* the destination pool, its latency drives adaptive throttling */
+	strlcpy(pool, name, sizeof(pool));
+	pool[strcspn(pool, "/")] = '\0';
+
+	pa.js = js;
+	pa.fd = fds[1];
+	pa.error = 0;
+	pa.pool = pool;
+
+	if ((error = pthread_create(&tid, NULL, pump_thread, &pa)) != 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return (je_error(hdl, JE_ERR_UNKNOWN, "pthread_create: %s",
+		    strerror(error)));
+	}
+
+	error = zfs_receive(hdl->lzh, name, props, &flags, fds[0], NULL);
+
+	close(fds[0]);
+	pthread_join(tid, NULL);
+
+	if (error != 0 || pa.error != 0)
+		return (je_error(hdl, JE_ERR_RECEIVE, "cannot receive '%s'", name));
+
+	return (0);
+}
@@ -0,0 +1,118 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * unmount the gathered datasets, children first. Jail environments are
+ * mounted at temporary mountpoints, so where a dataset is mounted comes
+ * from the mount table rather than from the mountpoint property.
+ */
+static int
+unmount_gathered(libjectl_handle_t *hdl, get_all_cb_t *cb, int flags)
+{
+	int error;
+	size_t i;
+	char *where;
+
+	error = 0;
+	for (i = cb->cb_used; i-- > 0 && error == 0;) {
+		if (!je_is_mounted(hdl, cb->cb_handles[i], &where))
+			continue;
+		if (zfs_unmount(cb->cb_handles[i], where, flags) == 0)
+			je_mnttab_remove(hdl, zfs_get_name(cb->cb_handles[i]));
+		else
+			error = je_error(hdl, JE_ERR_UNMOUNT,
+			    "cannot unmount '%s'", zfs_get_name(cb->cb_handles[i]));
+		free(where);
+	}
+
+	return (error);
+}
+
+/* unmount zhp and its descendants */
+int
+je_unmount_impl(libjectl_handle_t *hdl, zfs_handle_t *zhp, int flags)
+{
+	int error;
+	get_all_cb_t cb = { 0 };
+
+	if (!je_is_mounted(hdl, zhp, NULL))
+		return (0);
+
+	je_gather(zhp, &cb);
+	error = unmount_gathered(hdl, &cb, flags);
+	je_gather_free(&cb);
+
+	return (error);
+}
+
+/*
+ * unmount the persistent datasets of jds, they are mounted on top of the
+ * active jail environment and have to go first
+ */
+int
+je_unmount_persistent(libjectl_handle_t *hdl, zfs_handle_t *jds, int flags)
+{
+	int error;
+	get_all_cb_t cb = { 0 };
+
+	je_gather_persistent(jds, &cb);
+	error = unmount_gathered(hdl, &cb, flags);
+	je_gather_free(&cb);
+
+	return (error);
+}
+
+/* unmount the active jail environment of jail */
+int
+je_unmount(libjectl_handle_t *hdl, const char *jail, int flags)
+{
+	int error;
+	zfs_handle_t *je, *jds;
+
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (hdl->error);
+
+	if ((je = get_active_je(hdl, jds)) == NULL) {
+		error = je_error(hdl, JE_ERR_NOACTIVE,
+		    "cannot find active jail environment for '%s'",
+		    zfs_get_name(jds));
+		zfs_close(jds);
+		return (error);
+	}
+
+	if ((error = je_unmount_persistent(hdl, jds, flags)) == 0)
+		error = je_unmount_impl(hdl, je, flags);
+
+	zfs_close(je);
+	zfs_close(jds);
+
+	return (error);
+}
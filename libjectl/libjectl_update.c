@@ -28,7 +28,7 @@
 #include <stdbool.h>
 #include <libzfs_impl.h>
 
-#include "jectl.h"
+#include "libjectl_impl.h"
 
 struct compare_info {
 	zfs_handle_t *je;
@@ -98,76 +98,75 @@ done:
 }
 
 /*
+ * newest jail environment in the jepools the active jail environment of
+ * jds can be updated to, NULL if there is none.
+ *
  * only handles when FreeBSD_version is bumped
  * needs a more sophisticated update mechanism.
  */
-static zfs_handle_t *
-je_next(zfs_handle_t *jds)
+zfs_handle_t *
+je_candidate(libjectl_handle_t *hdl, zfs_handle_t *jds)
 {
+	int i;
 	struct compare_info ci;
 	zfs_handle_t *root, *je;
 
-	if ((je = get_active_je(jds)) == NULL) {
-		fprintf(stderr, "cannot find active jail environment: %s\n", zfs_get_name(jds));
+	if ((je = get_active_je(hdl, jds)) == NULL) {
+		je_error(hdl, JE_ERR_NOACTIVE,
+		    "cannot find active jail environment: %s", zfs_get_name(jds));
 		return (NULL);
 	}
 
-	root = zfs_open(lzh, jepool, ZFS_TYPE_FILESYSTEM);
-
 	ci.je = je;
 	ci.result = NULL;
-	zfs_iter_filesystems(root, compare_je, &ci);
 
-	zfs_close(je);
-	zfs_close(root);
+	for (i = 0; i < hdl->njepools; i++) {
+		if ((root = zfs_open(hdl->lzh, hdl->jepools[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		zfs_iter_filesystems(root, compare_je, &ci);
+		zfs_close(root);
+	}
 
-	if (ci.result == NULL)
-		return (NULL);
+	zfs_close(je);
 
-	return (je_copy(ci.result, jds));
+	return (ci.result);
 }
 
-static int
-je_update(zfs_handle_t *jds)
+static zfs_handle_t *
+je_next(libjectl_handle_t *hdl, zfs_handle_t *jds)
 {
-	int error;
-	zfs_handle_t *next;
-
-	/* no update found, return with no error */
-	if ((next = je_next(jds)) == NULL)
-		return (0);
+	zfs_handle_t *candidate;
 
-	error = je_swapin(jds, next);
-
-	zfs_close(next);
+	if ((candidate = je_candidate(hdl, jds)) == NULL)
+		return (NULL);
 
-	return (error);
+	/* je_copy consumes the candidate handle */
+	return (je_copy(hdl, candidate, jds));
 }
 
-static int
-jectl_update(int argc, char **argv)
+/*
+ * switch jail to the newest jail environment it can be updated to, having
+ * no update available is not an error.
+ */
+int
+je_update(libjectl_handle_t *hdl, const char *jail)
 {
 	int error;
-	zfs_handle_t *jds;
-
-	if (argc < 2 || argc > 3) {
-		fprintf(stderr, "usage: jectl update <jailname> [mountpoint]\n");
-		exit(1);
-	}
+	zfs_handle_t *jds, *next;
 
-	if ((jds = get_jail_dataset(argv[1])) == NULL)
-		return (1);
+	if ((jds = get_jail_dataset(hdl, jail)) == NULL)
+		return (hdl->error);
 
-	if (je_update(jds) != 0)
-		fprintf(stderr, "cannot update '%s'\n", zfs_get_name(jds));
+	hdl->error = JE_ERR_SUCCESS;
+	if ((next = je_next(hdl, jds)) == NULL) {
+		zfs_close(jds);
+		return (hdl->error);
+	}
 
-	if (argc == 3) {
-		error = je_mount(jds, argv[2]);
-	} else
-		error = 0;
+	error = je_swapin(hdl, jds, next);
 
+	zfs_close(next);
 	zfs_close(jds);
 
 	return (error);
 }
-JE_COMMAND(jectl, update, jectl_update);
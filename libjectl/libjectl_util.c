@@ -0,0 +1,534 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdbool.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/* get dataset for the given jail */
+zfs_handle_t *
+get_jail_dataset(libjectl_handle_t *hdl, const char *jailname)
+{
+	int i;
+	char jds_name[ZFS_MAXPROPLEN];
+	zfs_handle_t *jds;
+
+	/* path to jail dataset, $jeroot/$jailname */
+	for (i = 0; i < hdl->njeroots; i++) {
+		snprintf(jds_name, sizeof(jds_name), "%s/%s", hdl->jeroots[i],
+		    jailname);
+		if (!zfs_dataset_exists(hdl->lzh, jds_name, ZFS_TYPE_FILESYSTEM))
+			continue;
+		if ((jds = zfs_open(hdl->lzh, jds_name, ZFS_TYPE_FILESYSTEM)) == NULL)
+			je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", jds_name);
+		return (jds);
+	}
+
+	je_error(hdl, JE_ERR_NOJAIL, "cannot find jail dataset for '%s'",
+	    jailname);
+	return (NULL);
+}
+
+/*
+ * does $root/name exist under any of the given roots
+ */
+bool
+je_exists(libjectl_handle_t *hdl, je_root_t type, const char *name)
+{
+	int i, count;
+	const char * const *roots;
+	char buf[ZFS_MAX_DATASET_NAME_LEN];
+
+	count = libjectl_get_roots(hdl, type, &roots);
+	for (i = 0; i < count; i++) {
+		snprintf(buf, sizeof(buf), "%s/%s", roots[i], name);
+		if (zfs_dataset_exists(hdl->lzh, buf, ZFS_TYPE_FILESYSTEM))
+			return (true);
+	}
+
+	return (false);
+}
+
+/*
+ * pick the root a new dataset is created under
+ */
+const char *
+je_place(libjectl_handle_t *hdl, je_root_t type)
+{
+	int i, count;
+	uint64_t avail, best;
+	const char * const *roots;
+	const char *root;
+	zfs_handle_t *zhp;
+
+	count = libjectl_get_roots(hdl, type, &roots);
+	if (hdl->placement == JE_PLACE_FIRST || count == 1)
+		return (roots[0]);
+
+	root = roots[0];
+	best = 0;
+	for (i = 0; i < count; i++) {
+		if ((zhp = zfs_open(hdl->lzh, roots[i], ZFS_TYPE_FILESYSTEM)) == NULL)
+			continue;
+		avail = zfs_prop_get_int(zhp, ZFS_PROP_AVAILABLE);
+		if (avail > best) {
+			best = avail;
+			root = roots[i];
+		}
+		zfs_close(zhp);
+	}
+
+	return (root);
+}
+
+/* get active jail environment */
+zfs_handle_t *
+get_active_je(libjectl_handle_t *hdl, zfs_handle_t *jds)
+{
+	char *je_name;
+
+	if (get_property(jds, "je:active", &je_name) != 0)
+		return (NULL);
+
+	return (zfs_open(hdl->lzh, je_name, ZFS_TYPE_FILESYSTEM));
+}
+
+int
+get_property(zfs_handle_t *zhp, const char *property, char **val)
+{
+	int error;
+	nvlist_t *nvl, *propval;
+
+	if ((nvl = zfs_get_user_props(zhp)) == NULL)
+		return (1);
+
+	if ((error = nvlist_lookup_nvlist(nvl, property, &propval)) != 0)
+		return (error);
+
+	if ((error = nvlist_lookup_string(propval, ZPROP_VALUE, val)) != 0)
+		return (error);
+
+	/* user property has been "unset" */
+	if (strcmp(*val, "") == 0)
+		return (1);
+
+	return (0);
+}
+
+/* s as a JSON string, quoted and escaped */
+void
+je_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s != '\0'; s++) {
+		switch (*s) {
+		case '"':
+		case '\\':
+			fprintf(fp, "\\%c", *s);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		case '\t':
+			fputs("\\t", fp);
+			break;
+		default:
+			if ((unsigned char)*s < 0x20)
+				fprintf(fp, "\\u%04x", *s);
+			else
+				fputc(*s, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+/*
+ * Is zhp a persistent dataset kept beside the jail environments of its
+ * jail. Those have je:mountpoint, relative to the root of the jail, set
+ * on themselves; their descendants inherit it.
+ */
+bool
+je_persistent(zfs_handle_t *zhp)
+{
+	nvlist_t *nvl, *propval;
+	char *source;
+
+	if ((nvl = zfs_get_user_props(zhp)) == NULL)
+		return (false);
+	if (nvlist_lookup_nvlist(nvl, "je:mountpoint", &propval) != 0 ||
+	    nvlist_lookup_string(propval, ZPROP_SOURCE, &source) != 0)
+		return (false);
+
+	return (strcmp(source, zfs_get_name(zhp)) == 0);
+}
+
+/*
+ * return the user properties of zhp as a flat list of strings,
+ * suitable to be passed to zfs_prop_set_list(), zfs_clone() or
+ * zfs_receive().
+ */
+nvlist_t *
+je_user_props(zfs_handle_t *zhp)
+{
+	struct nvpair *nvp;
+	nvlist_t *nvl, *propval, *nnvl;
+	char *value;
+
+	if (nvlist_alloc(&nnvl, NV_UNIQUE_NAME, 0) != 0)
+		return (NULL);
+
+	nvl = zfs_get_user_props(zhp);
+
+	/*
+	 * This seems like a hack.
+	 * Trying to set the nvlist of src on target
+	 * without going through a temporary nvlist
+	 * doesn't work. I'm curious why that is.
+	 */
+	nvp = NULL;
+	while ((nvp = nvlist_next_nvpair(nvl, nvp)) != NULL) {
+		nvpair_value_nvlist(nvp, &propval);
+		nvlist_lookup_string(propval, ZPROP_VALUE, &value);
+		nvlist_add_string(nnvl, nvpair_name(nvp), value);
+	}
+
+	return (nnvl);
+}
+
+struct send_args {
+	const char *snapshot;
+	int fd;
+	int error;
+	bool print_on_error;
+};
+
+/*
+ * send a snapshot into fd, runs on its own libzfs handle
+ * because libzfs handles are not safe to share between threads.
+ */
+static void *
+send_thread(void *arg)
+{
+	sigset_t set;
+	struct send_args *sa;
+	libzfs_handle_t *hdl;
+	zfs_handle_t *zhp;
+	sendflags_t flags = { 0 };
+
+	sa = arg;
+	sa->error = 1;
+
+	/* a failed receive closes the pipe, take EPIPE over SIGPIPE */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	flags.largeblock = B_TRUE;
+	flags.embed_data = B_TRUE;
+	flags.compress = B_TRUE;
+
+	if ((hdl = libzfs_init()) == NULL)
+		goto out;
+	libzfs_print_on_error(hdl, sa->print_on_error);
+
+	if ((zhp = zfs_open(hdl, sa->snapshot, ZFS_TYPE_SNAPSHOT)) != NULL) {
+		sa->error = zfs_send_one(zhp, NULL, sa->fd, &flags, NULL);
+		zfs_close(zhp);
+	}
+
+	libzfs_fini(hdl);
+out:
+	close(sa->fd);
+	return (NULL);
+}
+
+/*
+ * A snapshot cannot be cloned into another pool, send it over instead.
+ */
+static int
+je_copy_send(libjectl_handle_t *hdl, const char *snapshot, const char *dest,
+    nvlist_t *props)
+{
+	int error, fds[2];
+	pthread_t tid;
+	struct send_args sa;
+	recvflags_t flags = { .nomount = 1 };
+
+	if (pipe(fds) != 0)
+		return (1);
+
+	sa.snapshot = snapshot;
+	sa.fd = fds[1];
+	sa.error = 0;
+	sa.print_on_error = hdl->print_on_error;
+
+	if ((error = pthread_create(&tid, NULL, send_thread, &sa)) != 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return (error);
+	}
+
+	nvlist_add_string(props, "canmount", "noauto");
+	nvlist_add_string(props, "mountpoint", "none");
+
+	error = zfs_receive(hdl->lzh, dest, props, &flags, fds[0], NULL);
+
+	/* unblock the sender if the receive bailed out early */
+	close(fds[0]);
+	pthread_join(tid, NULL);
+
+	return (error != 0 ? error : sa.error);
+}
+
+/* does dataset name live in the given pool */
+bool
+je_same_pool(const char *pool, const char *name)
+{
+	size_t len;
+
+	len = strlen(pool);
+	return (strncmp(pool, name, len) == 0 &&
+	    (name[len] == '/' || name[len] == '\0'));
+}
+
+/*
+ * Do the dirty work of copying a dataset:
+ *  - take a snapshot of src, named for this copy alone so that copies
+ *    of the same source running at the same time do not race for it
+ *  - clone that snapshot to dest, or send it when dest is another pool,
+ *    with the user properties of src and the properties of the profile
+ *    src was created with, set as the clone is created
+ *  - have the snapshot go away once nothing is cloned from it
+ *  - return zfs handle to the clone (i.e., a new dataset)
+ */
+zfs_handle_t *
+je_copy_impl(libjectl_handle_t *hdl, zfs_handle_t *src, const char *dest)
+{
+	int error;
+	nvlist_t *props;
+	zfs_handle_t *snapshot, *target;
+	struct timespec ts;
+	char stamp[32];
+	char snapshot_name[ZFS_MAX_DATASET_NAME_LEN];
+
+	/* everything in the one transaction that creates the clone */
+	if ((props = je_user_props(src)) == NULL) {
+		je_error(hdl, JE_ERR_NOMEM, "out of memory");
+		return (NULL);
+	}
+	nvlist_add_string(props, "canmount", "noauto");
+	if (je_profile_of(hdl, src, props) != 0) {
+		nvlist_free(props);
+		return (NULL);
+	}
+
+	/* a snapshot of src for this copy alone */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", gmtime(&ts.tv_sec));
+	snprintf(snapshot_name, sizeof(snapshot_name),
+	    "%s@" JE_COPY_SNAP ".%s.%09ld.%d", zfs_get_name(src), stamp,
+	    ts.tv_nsec, (int)getpid());
+	if (zfs_snapshot(hdl->lzh, snapshot_name, B_FALSE, NULL) != 0) {
+		je_error(hdl, JE_ERR_ZFSCLONE, "cannot snapshot '%s'",
+		    zfs_get_name(src));
+		nvlist_free(props);
+		return (NULL);
+	}
+
+	if (!je_same_pool(zfs_get_pool_name(src), dest)) {
+		error = je_copy_send(hdl, snapshot_name, dest, props);
+		/* dest keeps the received snapshot, src has no use for it */
+		if ((snapshot = zfs_open(hdl->lzh, snapshot_name,
+		    ZFS_TYPE_SNAPSHOT)) != NULL) {
+			zfs_destroy(snapshot, B_FALSE);
+			zfs_close(snapshot);
+		}
+	} else {
+		if ((snapshot = zfs_open(hdl->lzh, snapshot_name, ZFS_TYPE_SNAPSHOT)) == NULL) {
+			nvlist_free(props);
+			je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'",
+			    snapshot_name);
+			return (NULL);
+		}
+
+		error = zfs_clone(snapshot, dest, props);
+
+		/* goes away with the clone instead of piling up */
+		zfs_destroy(snapshot, error == 0);
+		zfs_close(snapshot);
+	}
+	nvlist_free(props);
+
+	if (error != 0) {
+		je_error(hdl, JE_ERR_ZFSCLONE, "cannot copy '%s' to '%s'",
+		    zfs_get_name(src), dest);
+		return (NULL);
+	}
+
+	if ((target = zfs_open(hdl->lzh, dest, ZFS_TYPE_FILESYSTEM)) == NULL) {
+		je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", dest);
+		return (NULL);
+	}
+
+	return (target);
+}
+
+/*
+ * copy src to target, the copied dataset becomes a child of target
+ */
+zfs_handle_t *
+je_copy(libjectl_handle_t *hdl, zfs_handle_t *src, zfs_handle_t *target)
+{
+	char dest[ZFS_MAX_DATASET_NAME_LEN];
+	zfs_handle_t *je;
+	char *name;
+
+	name = strdup(zfs_get_name(src));
+
+	snprintf(dest, sizeof(dest), "%s/%s", zfs_get_name(target), basename(name));
+
+	if (zfs_dataset_exists(hdl->lzh, dest, ZFS_TYPE_FILESYSTEM)) {
+		if ((je = zfs_open(hdl->lzh, dest, ZFS_TYPE_FILESYSTEM)) == NULL)
+			je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", dest);
+	} else {
+		je = je_copy_impl(hdl, src, dest);
+	}
+
+	zfs_close(src);
+	free(name);
+	return (je);
+}
+
+static int
+destroy_cb(zfs_handle_t *zhp, void *arg __unused)
+{
+	zfs_destroy(zhp, false);
+	return (0);
+}
+
+int
+je_destroy(zfs_handle_t *zhp)
+{
+	zfs_iter_dependents(zhp, B_TRUE, destroy_cb, NULL);
+	return (zfs_destroy(zhp, false));
+}
+
+static int
+rename_cb(zfs_handle_t *src, void *arg)
+{
+	zfs_handle_t *target;
+	struct renameflags flags = { 0 };
+	char *name;
+	char dest[ZFS_MAX_DATASET_NAME_LEN];
+
+	target = arg;
+
+	name = strdup(zfs_get_name(src));
+
+	snprintf(dest, sizeof(dest), "%s/%s", zfs_get_name(target), basename(name));
+
+	zfs_rename(src, dest, flags);
+
+	zfs_close(src);
+	free(name);
+	return (0);
+}
+
+/*
+ * move (rename) all child datasets from src to target
+ */
+static int
+je_rename(zfs_handle_t *src, zfs_handle_t *target)
+{
+	zfs_iter_filesystems(src, rename_cb, target);
+
+	return (0);
+}
+
+/*
+ * set target to be the active jail environment
+ */
+int
+je_swapin(libjectl_handle_t *hdl, zfs_handle_t *jds, zfs_handle_t *target)
+{
+	int error;
+	zfs_handle_t *src;
+	const char *jds_name;
+	uint64_t start, t;
+
+	jds_name = zfs_get_name(jds);
+	start = je_now_ns();
+
+	if ((src = get_active_je(hdl, jds)) == NULL) {
+		if (zfs_prop_set(jds, "je:active", zfs_get_name(target)) != 0)
+			return (je_error(hdl, JE_ERR_ZFSPROP,
+			    "cannot set je:active on '%s'", jds_name));
+		je_metrics_sample(jds_name, "swap", "propset", je_now_ns() - start, 0);
+		return (0);
+	}
+
+	/* already the active dataset */
+	if (strcmp(zfs_get_name(src), zfs_get_name(target)) == 0) {
+		zfs_close(src);
+		return (0);
+	}
+
+	if ((error = je_unmount_persistent(hdl, jds, 0)) != 0 ||
+	    (error = je_unmount_impl(hdl, src, 0)) != 0 ||
+	    (error = je_unmount_impl(hdl, target, 0)) != 0) {
+		zfs_close(src);
+		return (error);
+	}
+	je_metrics_sample(jds_name, "swap", "unmount", je_now_ns() - start, 0);
+
+	/*
+	 * move child datasets from src to target, persistent datasets kept
+	 * beside the jail environments stay where they are
+	 */
+	t = je_now_ns();
+	je_rename(src, target);
+	je_metrics_sample(jds_name, "swap", "rename", je_now_ns() - t, 0);
+
+	/* set new jail environment */
+	t = je_now_ns();
+	if (zfs_prop_set(jds, "je:active", zfs_get_name(target)) != 0) {
+		zfs_close(src);
+		return (je_error(hdl, JE_ERR_ZFSPROP,
+		    "cannot set je:active on '%s'", jds_name));
+	}
+	je_metrics_sample(jds_name, "swap", "propset", je_now_ns() - t, 0);
+
+	je_metrics_sample(jds_name, "swap", "total", je_now_ns() - start, 0);
+
+	zfs_close(src);
+	return (0);
+}
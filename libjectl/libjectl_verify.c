@@ -0,0 +1,729 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Klara Inc.
+ * Copyright (c) 2022 Rob Wing <rob.wing@klarasystems.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fts.h>
+#include <pthread.h>
+#include <sha256.h>
+#include <vis.h>
+#include <libzfs_impl.h>
+
+#include "libjectl_impl.h"
+
+/*
+ * Verify a jail environment against the manifest generate-je.sh recorded
+ * in it, the flat mtree(8) specification of the world as built:
+ *
+ *	./bin/sh type=file sha256digest=...
+ *	./etc/termcap type=link link=/usr/share/misc/termcap
+ *
+ * The manifest is a file of the jail environment, so its own SHA256 is
+ * kept in je:manifest and checked first. A full verify walks the whole
+ * dataset, an incremental one only looks at what zfs diff reports as
+ * changed since the origin snapshot and trusts the rest. Regular files
+ * are hashed by a pool of threads.
+ *
+ * Differences are printed the way zfs diff prints them: M for modified,
+ * - for missing and + for extra files.
+ */
+#define	MANIFEST		"var/db/jectl.mtree"
+#define	VERIFY_MAXTHREADS	16
+
+struct verify_entry {
+	char *path;		/* relative, "bin/sh" */
+	char *type;		/* as mtree(8) names it, "file", "dir"... */
+	char *digest;		/* SHA256 of a regular file */
+	char *link;		/* target of a symbolic link */
+	bool seen;
+	char status;		/* 'M' or '-' once found to differ */
+};
+
+struct verify {
+	const char *root;	/* where the jail environment is mounted */
+	FILE *fp;
+	struct verify_entry *v;	/* the manifest, sorted by path */
+	size_t count;
+	size_t alloc;
+	struct verify_entry **files;	/* regular files to hash */
+	size_t nfiles;
+	size_t filesalloc;
+	size_t next;
+	uint64_t bytes;		/* hashed */
+	uint64_t extra;
+	int error;
+	char failed[MAXPATHLEN];
+	pthread_mutex_t lock;
+};
+
+/* '/' sorts first, so the contents of a directory directly follow it */
+static int
+verify_pathcmp(const char *a, const char *b)
+{
+	for (; *a == *b; a++, b++) {
+		if (*a == '\0')
+			return (0);
+	}
+	if (*a == '\0')
+		return (-1);
+	if (*b == '\0')
+		return (1);
+	if (*a == '/')
+		return (-1);
+	if (*b == '/')
+		return (1);
+
+	return ((unsigned char)*a - (unsigned char)*b);
+}
+
+static int
+verify_entrycmp(const void *a, const void *b)
+{
+	return (verify_pathcmp(((const struct verify_entry *)a)->path,
+	    ((const struct verify_entry *)b)->path));
+}
+
+static struct verify_entry *
+verify_lookup(struct verify *vf, const char *path)
+{
+	struct verify_entry key;
+
+	key.path = (char *)path;
+	return (bsearch(&key, vf->v, vf->count, sizeof(*vf->v),
+	    verify_entrycmp));
+}
+
+static const char *
+verify_type(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		return ("file");
+	case S_IFDIR:
+		return ("dir");
+	case S_IFLNK:
+		return ("link");
+	case S_IFCHR:
+		return ("char");
+	case S_IFBLK:
+		return ("block");
+	case S_IFIFO:
+		return ("fifo");
+	case S_IFSOCK:
+		return ("socket");
+	}
+
+	return ("unknown");
+}
+
+/* mtree(8) vis(3) encodes names, a space is \040 */
+static char *
+manifest_unvis(const char *src)
+{
+	char *dst;
+
+	if ((dst = malloc(strlen(src) + 1)) == NULL)
+		return (NULL);
+	if (strunvis(dst, src) < 0) {
+		free(dst);
+		return (NULL);
+	}
+
+	return (dst);
+}
+
+static int
+manifest_parse(struct verify *vf, char *line)
+{
+	char *field, *value;
+	struct verify_entry *e;
+
+	line[strcspn(line, "\n")] = '\0';
+
+	/* "." is the root, which is not the jail environment's to change */
+	field = strsep(&line, " ");
+	if (strncmp(field, "./", 2) != 0)
+		return (0);
+
+	if (vf->count == vf->alloc) {
+		vf->alloc = vf->alloc == 0 ? 4096 : vf->alloc * 2;
+		vf->v = reallocf(vf->v, vf->alloc * sizeof(*vf->v));
+		if (vf->v == NULL) {
+			vf->count = vf->alloc = 0;
+			return (ENOMEM);
+		}
+	}
+
+	e = &vf->v[vf->count];
+	memset(e, 0, sizeof(*e));
+	if ((e->path = manifest_unvis(field + 2)) == NULL)
+		return (EINVAL);
+	vf->count++;
+
+	while ((field = strsep(&line, " ")) != NULL) {
+		if ((value = strchr(field, '=')) == NULL)
+			continue;
+		*value++ = '\0';
+		if (strcmp(field, "type") == 0) {
+			if ((e->type = strdup(value)) == NULL)
+				return (ENOMEM);
+		} else if (strcmp(field, "sha256digest") == 0 ||
+		    strcmp(field, "sha256") == 0) {
+			if ((e->digest = strdup(value)) == NULL)
+				return (ENOMEM);
+		} else if (strcmp(field, "link") == 0) {
+			if ((e->link = manifest_unvis(value)) == NULL)
+				return (EINVAL);
+		}
+	}
+
+	return (e->type == NULL ? EINVAL : 0);
+}
+
+static void
+manifest_free(struct verify *vf)
+{
+	size_t i;
+
+	for (i = 0; i < vf->count; i++) {
+		free(vf->v[i].path);
+		free(vf->v[i].type);
+		free(vf->v[i].digest);
+		free(vf->v[i].link);
+	}
+	free(vf->v);
+	free(vf->files);
+}
+
+/* read the manifest of je, mounted at vf->root, once it checks out */
+static int
+manifest_load(libjectl_handle_t *hdl, struct verify *vf, zfs_handle_t *je)
+{
+	int error;
+	FILE *fp;
+	char *recorded, *line;
+	size_t linecap;
+	char path[MAXPATHLEN], digest[SHA256_DIGEST_STRING_LENGTH];
+
+	if (get_property(je, "je:manifest", &recorded) != 0)
+		return (je_error(hdl, JE_ERR_NOENT, "'%s' has no manifest",
+		    zfs_get_name(je)));
+
+	snprintf(path, sizeof(path), "%s/" MANIFEST, vf->root);
+	if (SHA256_File(path, digest) == NULL)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", path,
+		    strerror(errno)));
+	if (strcasecmp(digest, recorded) != 0)
+		return (je_error(hdl, JE_ERR_VERIFY,
+		    "%s does not match je:manifest of '%s'", path,
+		    zfs_get_name(je)));
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", path,
+		    strerror(errno)));
+
+	error = 0;
+	line = NULL;
+	linecap = 0;
+	while (error == 0 && getline(&line, &linecap, fp) > 0)
+		error = manifest_parse(vf, line);
+	free(line);
+	fclose(fp);
+
+	if (error != 0)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", path,
+		    strerror(error)));
+
+	qsort(vf->v, vf->count, sizeof(*vf->v), verify_entrycmp);
+	return (0);
+}
+
+/* compare what is at path with its entry e, regular files are queued */
+static int
+verify_check(struct verify *vf, struct verify_entry *e, const char *path,
+    const struct stat *sb)
+{
+	ssize_t len;
+	char target[MAXPATHLEN];
+
+	e->seen = true;
+	if (strcmp(e->type, verify_type(sb->st_mode)) != 0) {
+		e->status = 'M';
+		return (0);
+	}
+
+	if (S_ISLNK(sb->st_mode)) {
+		if ((len = readlink(path, target, sizeof(target) - 1)) < 0)
+			return (errno);
+		target[len] = '\0';
+		if (e->link == NULL || strcmp(e->link, target) != 0)
+			e->status = 'M';
+		return (0);
+	}
+
+	if (!S_ISREG(sb->st_mode) || e->digest == NULL)
+		return (0);
+
+	if (vf->nfiles == vf->filesalloc) {
+		vf->filesalloc = vf->filesalloc == 0 ? 4096 : vf->filesalloc * 2;
+		vf->files = reallocf(vf->files,
+		    vf->filesalloc * sizeof(*vf->files));
+		if (vf->files == NULL) {
+			vf->nfiles = vf->filesalloc = 0;
+			return (ENOMEM);
+		}
+	}
+	vf->files[vf->nfiles++] = e;
+	vf->bytes += sb->st_size;
+
+	return (0);
+}
+
+static void
+verify_extra(struct verify *vf, const char *path)
+{
+	fprintf(vf->fp, "+\t/%s\n", path);
+	vf->extra++;
+}
+
+/* what is below a mount point is not in this dataset, nothing is missing */
+static void
+verify_skip(struct verify *vf, const char *path)
+{
+	size_t i, len;
+	struct verify_entry *e;
+
+	if ((e = verify_lookup(vf, path)) == NULL)
+		return;
+
+	len = strlen(path);
+	for (i = e - vf->v; i < vf->count; i++) {
+		e = &vf->v[i];
+		if (strncmp(e->path, path, len) != 0 ||
+		    (e->path[len] != '\0' && e->path[len] != '/'))
+			break;
+		e->seen = true;
+	}
+}
+
+/* full verify, everything in the dataset and everything in the manifest */
+static int
+verify_walk(struct verify *vf)
+{
+	FTS *fts;
+	FTSENT *ent;
+	struct verify_entry *e;
+	const char *path;
+	size_t i;
+	dev_t dev;
+	int error;
+	char *paths[] = { (char *)vf->root, NULL };
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL) {
+		strlcpy(vf->failed, vf->root, sizeof(vf->failed));
+		return (errno);
+	}
+
+	error = 0;
+	dev = 0;
+	while (error == 0 && (ent = fts_read(fts)) != NULL) {
+		switch (ent->fts_info) {
+		case FTS_DP:
+			continue;
+		case FTS_DNR:
+		case FTS_ERR:
+		case FTS_NS:
+			strlcpy(vf->failed, ent->fts_path, sizeof(vf->failed));
+			error = ent->fts_errno;
+			continue;
+		}
+
+		if (ent->fts_level == 0) {
+			dev = ent->fts_statp->st_dev;
+			continue;
+		}
+
+		path = ent->fts_path + strlen(vf->root) + 1;
+		if (strcmp(path, MANIFEST) == 0)
+			continue;
+
+		/* config, persistent datasets */
+		if (ent->fts_statp->st_dev != dev) {
+			fts_set(fts, ent, FTS_SKIP);
+			verify_skip(vf, path);
+			continue;
+		}
+
+		if ((e = verify_lookup(vf, path)) == NULL) {
+			verify_extra(vf, path);
+			/* its contents are extra too, needless to say */
+			if (ent->fts_info == FTS_D)
+				fts_set(fts, ent, FTS_SKIP);
+			continue;
+		}
+
+		if ((error = verify_check(vf, e, ent->fts_path,
+		    ent->fts_statp)) != 0)
+			strlcpy(vf->failed, ent->fts_path, sizeof(vf->failed));
+	}
+	fts_close(fts);
+
+	if (error != 0)
+		return (error);
+
+	for (i = 0; i < vf->count; i++) {
+		if (!vf->v[i].seen)
+			vf->v[i].status = '-';
+	}
+
+	return (0);
+}
+
+/* incremental verify of one path zfs diff reported */
+static int
+verify_path(struct verify *vf, const char *path)
+{
+	struct verify_entry *e;
+	struct stat sb;
+	int error;
+	char full[MAXPATHLEN];
+
+	if (*path == '\0' || strcmp(path, MANIFEST) == 0)
+		return (0);
+
+	e = verify_lookup(vf, path);
+	if (e != NULL && e->seen)
+		return (0);
+
+	snprintf(full, sizeof(full), "%s/%s", vf->root, path);
+	if (lstat(full, &sb) != 0) {
+		if (errno != ENOENT) {
+			strlcpy(vf->failed, full, sizeof(vf->failed));
+			return (errno);
+		}
+		if (e != NULL) {
+			e->seen = true;
+			e->status = '-';
+		}
+		return (0);
+	}
+
+	if (e == NULL) {
+		verify_extra(vf, path);
+		return (0);
+	}
+
+	if ((error = verify_check(vf, e, full, &sb)) != 0)
+		strlcpy(vf->failed, full, sizeof(vf->failed));
+	return (error);
+}
+
+/* zfs diff escapes bytes outside of printable ASCII as \ooo or \oooo */
+static void
+verify_unescape(char *s)
+{
+	char *d;
+	int i, c;
+
+	for (d = s; *s != '\0'; d++) {
+		if (*s != '\\' || s[1] < '0' || s[1] > '7') {
+			*d = *s++;
+			continue;
+		}
+		s++;
+		for (i = 0, c = 0; i < 4 && *s >= '0' && *s <= '7'; i++, s++)
+			c = c * 8 + (*s - '0');
+		*d = c;
+	}
+	*d = '\0';
+}
+
+/* incremental verify, what changed since the origin snapshot of je */
+static int
+verify_changed(libjectl_handle_t *hdl, struct verify *vf, zfs_handle_t *je)
+{
+	int error;
+	FILE *diff;
+	char *line, *rest, *field;
+	size_t linecap, rootlen;
+	char origin[ZFS_MAX_DATASET_NAME_LEN];
+
+	if (zfs_prop_get(je, ZFS_PROP_ORIGIN, origin, sizeof(origin), NULL,
+	    NULL, 0, B_FALSE) != 0 || origin[0] == '\0' ||
+	    strcmp(origin, "-") == 0)
+		return (je_error(hdl, JE_ERR_INVALIDARG,
+		    "'%s' has no origin snapshot, verify it in full",
+		    zfs_get_name(je)));
+
+	if ((diff = tmpfile()) == NULL)
+		return (je_error(hdl, JE_ERR_IO, "tmpfile: %s", strerror(errno)));
+
+	if (zfs_show_diffs(je, fileno(diff), origin, NULL,
+	    ZFS_DIFF_PARSEABLE) != 0) {
+		fclose(diff);
+		return (je_error(hdl, JE_ERR_UNKNOWN,
+		    "cannot diff '%s' against '%s'", zfs_get_name(je), origin));
+	}
+	rewind(diff);
+
+	/* M, +, - then the path, R then the old and the new path */
+	error = 0;
+	line = NULL;
+	linecap = 0;
+	rootlen = strlen(vf->root);
+	while (error == 0 && getline(&line, &linecap, diff) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+		rest = line;
+		strsep(&rest, "\t");
+		while (error == 0 && (field = strsep(&rest, "\t")) != NULL) {
+			verify_unescape(field);
+			if (strncmp(field, vf->root, rootlen) != 0 ||
+			    (field[rootlen] != '/' && field[rootlen] != '\0'))
+				continue;
+			field += rootlen;
+			while (*field == '/')
+				field++;
+			error = verify_path(vf, field);
+		}
+	}
+	free(line);
+	fclose(diff);
+
+	if (error != 0)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", vf->failed,
+		    strerror(error)));
+
+	return (0);
+}
+
+static void
+verify_fail(struct verify *vf, const char *path, int error)
+{
+	pthread_mutex_lock(&vf->lock);
+	if (vf->error == 0) {
+		vf->error = error;
+		strlcpy(vf->failed, path, sizeof(vf->failed));
+	}
+	pthread_mutex_unlock(&vf->lock);
+}
+
+static void *
+verify_thread(void *arg)
+{
+	struct verify *vf;
+	struct verify_entry *e;
+	size_t i;
+	char path[MAXPATHLEN], digest[SHA256_DIGEST_STRING_LENGTH];
+
+	vf = arg;
+	for (;;) {
+		pthread_mutex_lock(&vf->lock);
+		i = vf->next++;
+		if (vf->error != 0)
+			i = vf->nfiles;
+		pthread_mutex_unlock(&vf->lock);
+
+		if (i >= vf->nfiles)
+			break;
+
+		e = vf->files[i];
+		snprintf(path, sizeof(path), "%s/%s", vf->root, e->path);
+		if (SHA256_File(path, digest) == NULL) {
+			verify_fail(vf, path, errno);
+			break;
+		}
+		if (strcasecmp(digest, e->digest) != 0)
+			e->status = 'M';
+	}
+
+	return (NULL);
+}
+
+static int
+verify_hash(libjectl_handle_t *hdl, struct verify *vf)
+{
+	int i, nthreads;
+	pthread_t tids[VERIFY_MAXTHREADS];
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > VERIFY_MAXTHREADS)
+		nthreads = VERIFY_MAXTHREADS;
+
+	pthread_mutex_init(&vf->lock, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, verify_thread, vf) != 0)
+			break;
+	}
+	nthreads = i;
+	/* no thread to spare, do it ourselves */
+	if (nthreads == 0)
+		verify_thread(vf);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&vf->lock);
+
+	if (vf->error != 0)
+		return (je_error(hdl, JE_ERR_IO, "%s: %s", vf->failed,
+		    strerror(vf->error)));
+
+	return (0);
+}
+
+static int
+verify_report(libjectl_handle_t *hdl, struct verify *vf, zfs_handle_t *je)
+{
+	size_t i, checked;
+	uint64_t modified, missing;
+	struct verify_entry *e;
+
+	checked = modified = missing = 0;
+	for (i = 0; i < vf->count; i++) {
+		e = &vf->v[i];
+		if (e->seen)
+			checked++;
+		if (e->status == '\0')
+			continue;
+		fprintf(vf->fp, "%c\t/%s\n", e->status, e->path);
+		if (e->status == 'M')
+			modified++;
+		else
+			missing++;
+	}
+
+	je_info(hdl, "%s: %zu checked, %ju modified, %ju missing, %ju extra",
+	    zfs_get_name(je), checked, (uintmax_t)modified,
+	    (uintmax_t)missing, (uintmax_t)vf->extra);
+
+	if (modified + missing + vf->extra != 0)
+		return (je_error(hdl, JE_ERR_VERIFY,
+		    "'%s' does not match its manifest", zfs_get_name(je)));
+
+	return (0);
+}
+
+/* the active jail environment of jail name, else jail environment name */
+static zfs_handle_t *
+verify_open(libjectl_handle_t *hdl, const char *name)
+{
+	int i;
+	zfs_handle_t *jds, *je;
+	char buf[ZFS_MAX_DATASET_NAME_LEN];
+
+	if (je_exists(hdl, JE_ROOT_JEROOT, name)) {
+		if ((jds = get_jail_dataset(hdl, name)) == NULL)
+			return (NULL);
+		if ((je = get_active_je(hdl, jds)) == NULL)
+			je_error(hdl, JE_ERR_NOACTIVE,
+			    "cannot find active jail environment for '%s'",
+			    zfs_get_name(jds));
+		zfs_close(jds);
+		return (je);
+	}
+
+	for (i = 0; i < hdl->njepools; i++) {
+		snprintf(buf, sizeof(buf), "%s/%s", hdl->jepools[i], name);
+		if (!zfs_dataset_exists(hdl->lzh, buf, ZFS_TYPE_FILESYSTEM))
+			continue;
+		if ((je = zfs_open(hdl->lzh, buf, ZFS_TYPE_FILESYSTEM)) == NULL)
+			je_error(hdl, JE_ERR_ZFSOPEN, "cannot open '%s'", buf);
+		return (je);
+	}
+
+	je_error(hdl, JE_ERR_NOENT,
+	    "cannot find jail or jail environment '%s'", name);
+	return (NULL);
+}
+
+/*
+ * Verify the active jail environment of jail name, or the jail
+ * environment name, against its manifest. Differences are printed to fp
+ * and make it fail with JE_ERR_VERIFY. One that is not mounted is
+ * mounted read-only below /tmp for the time being.
+ */
+int
+je_verify(libjectl_handle_t *hdl, const char *name, int flags, FILE *fp)
+{
+	int error;
+	bool mounted;
+	zfs_handle_t *je;
+	struct verify vf;
+	char *where;
+	char tmp[MAXPATHLEN];
+	uint64_t start;
+
+	if ((je = verify_open(hdl, name)) == NULL)
+		return (hdl->error);
+
+	where = NULL;
+	if (!(mounted = je_is_mounted(hdl, je, &where))) {
+		strlcpy(tmp, "/tmp/jectl.verify.XXXXXX", sizeof(tmp));
+		if (mkdtemp(tmp) == NULL) {
+			zfs_close(je);
+			return (je_error(hdl, JE_ERR_IO, "mkdtemp: %s",
+			    strerror(errno)));
+		}
+		if (zfs_mount_at(je, "ro", 0, tmp) != 0) {
+			rmdir(tmp);
+			zfs_close(je);
+			return (je_error(hdl, JE_ERR_MOUNT,
+			    "cannot mount '%s' at '%s'", zfs_get_name(je), tmp));
+		}
+	}
+
+	start = je_now_ns();
+	memset(&vf, 0, sizeof(vf));
+	vf.root = mounted ? where : tmp;
+	vf.fp = fp;
+
+	if ((error = manifest_load(hdl, &vf, je)) == 0) {
+		if ((flags & JE_VERIFY_INCREMENTAL) != 0)
+			error = verify_changed(hdl, &vf, je);
+		else if ((error = verify_walk(&vf)) != 0)
+			error = je_error(hdl, JE_ERR_IO, "%s: %s", vf.failed,
+			    strerror(error));
+	}
+	if (error == 0)
+		error = verify_hash(hdl, &vf);
+	if (error == 0) {
+		je_metrics_sample(zfs_get_name(je), "verify",
+		    (flags & JE_VERIFY_INCREMENTAL) != 0 ? "incremental" : "full",
+		    je_now_ns() - start, vf.bytes);
+		error = verify_report(hdl, &vf, je);
+	}
+
+	manifest_free(&vf);
+	if (!mounted) {
+		zfs_unmount(je, tmp, 0);
+		rmdir(tmp);
+	}
+	free(where);
+	zfs_close(je);
+
+	return (error);
+}